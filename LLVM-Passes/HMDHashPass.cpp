@@ -1,23 +1,140 @@
 #define DEBUG_TYPE "HMDHashPass"
 #include "utils/utils.h"
+#include "utils/Allocation.h"
 
 #include "llvm/IR/GlobalVariable.h"
 #include "llvm/IR/GlobalObject.h"
 #include "llvm/ADT/StringRef.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/IR/CFG.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/ScalarEvolution.h"
+#include "llvm/Analysis/ScalarEvolutionExpander.h"
+#include "llvm/Analysis/ScalarEvolutionExpressions.h"
+#include "llvm/IR/MDBuilder.h"
+#include "llvm/Analysis/ValueTracking.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+#include "llvm/Support/CommandLine.h"
+#include <fstream>
 
 #define SENTINEL ((void*) 0)
 
+static cl::opt<bool> OptRedundantChecks("hm-redundant-checks",
+    cl::desc("Remove checks dominated by a check of the same pointer and at least the same size"),
+    cl::init(true));
+
+static cl::opt<bool> OptHoistLoopChecks("hm-hoist-loop-checks",
+    cl::desc("Replace the checks of affine accesses in a loop by a single range check before the loop"),
+    cl::init(true));
+
+// Requires a runtime which poisons its red-zones (fastCheckInit enabled): with only the registration, the pattern is never
+// found inline, and the runtime is never called.
+static cl::opt<bool> OptInlineFastPath("hm-inline-fast-path",
+    cl::desc("Compare accessed bytes with the red-zone pattern inline, and only call the runtime on a match "
+        "(requires a runtime with poisoned red-zones)"),
+    cl::init(true));
+
+// Must be equal to the redzone pattern of the runtime.
+static cl::opt<unsigned> OptRedzonePattern("hm-redzone-pattern",
+    cl::desc("The red-zone pattern byte of the runtime, used by the inline fast path"),
+    cl::init(0xFF));
+
+static cl::opt<bool> OptSkipNonHeap("hm-skip-non-heap",
+    cl::desc("Do not check accesses of which the underlying object is a stack or global variable, or a constant"),
+    cl::init(true));
+
+static cl::opt<bool> OptInBoundsChecks("hm-in-bounds-checks",
+    cl::desc("Remove checks of accesses proven to lie within the heap object they are based on"),
+    cl::init(true));
+
+static cl::opt<bool> OptCoalesceChecks("hm-coalesce-checks",
+    cl::desc("Merge the checks of accesses at constant offsets from the same base in a basic block into one wider check"),
+    cl::init(true));
+
+static cl::opt<unsigned> OptCoalesceMaxSpan("hm-coalesce-max-span",
+    cl::desc("The largest amount of bytes covered by a merged check"),
+    cl::init(64));
+
+static cl::opt<bool> OptEarlyChecks("hm-early-checks",
+    cl::desc("Emit checks as calls to __hmbounds_check, to be lowered by -hmboundslowerpass after optimization"),
+    cl::init(false));
+
+static cl::opt<bool> OptSampleChecks("hm-sample-checks",
+    cl::desc("Only check 1 in __hmbounds_sample_rate executions of every check site, until it finds a red-zone access"),
+    cl::init(false));
+
+static cl::opt<bool> OptProfileGen("hm-profile-gen",
+    cl::desc("Count the executions of every check site, for a profile used by -hm-profile-use"),
+    cl::init(false));
+
+static cl::opt<std::string> OptProfileUse("hm-profile-use",
+    cl::desc("Profile of an -hm-profile-gen build, used to check cold sites out-of-line and only hoist hot loop checks"),
+    cl::value_desc("path"));
+
+static cl::opt<unsigned> OptHotThreshold("hm-hot-threshold",
+    cl::desc("Amount of executions in the profile from which a check site is hot"),
+    cl::init(1000));
+
+static cl::opt<bool> OptCloneUnchecked("hm-clone-unchecked",
+    cl::desc("Give every function an unchecked clone, run while __hmbounds_checks_enabled is clear for the thread"),
+    cl::init(false));
+
+STATISTIC(NChecks, "Number of memory accesses checked");
+STATISTIC(NRedundantChecks, "Number of checks removed as redundant");
+STATISTIC(NHoistedChecks, "Number of loop checks replaced by a range check");
+STATISTIC(NRangeChecks, "Number of range checks inserted before loops");
+STATISTIC(NInlineChecks, "Number of checks with an inline fast path");
+STATISTIC(NNonHeapAccesses, "Number of stack, global and constant accesses left unchecked");
+STATISTIC(NInBoundsChecks, "Number of checks removed as statically in-bounds");
+STATISTIC(NCoalescedChecks, "Number of checks merged into a wider check");
+STATISTIC(NWideChecks, "Number of wider checks inserted for merged checks");
+STATISTIC(NLoweredChecks, "Number of __hmbounds_check calls lowered");
+STATISTIC(NSampledChecks, "Number of check sites with a sampling countdown");
+STATISTIC(NProfiledSites, "Number of check sites counted for the profile");
+STATISTIC(NColdChecks, "Number of cold check sites checked out-of-line");
+STATISTIC(NUncheckedClones, "Number of functions with an unchecked clone");
+
 namespace {
     class DlibTestPass : public ModulePass {
     public:
         static char ID;
       	DlibTestPass() : ModulePass(ID) {}
         virtual bool runOnModule(Module &M) override;
+        virtual void getAnalysisUsage(AnalysisUsage &AU) const override;
 
     private:
-        bool instrumentFunction(Module &M, Function &F);
+        bool instrumentFunction(Module &M, Function &F, bool checkAccesses);
+
+        void removeInBoundsChecks(Function &F, SmallVectorImpl<Instruction*> &WorkList, const DataLayout &DL);
+
+        void hoistLoopChecks(Function &F, SmallVectorImpl<Instruction*> &WorkList, const DataLayout &DL,
+            Function *checkRangeFunc);
+
+        void coalesceChecks(Function &F, SmallVectorImpl<Instruction*> &WorkList, const DataLayout &DL,
+            Function *checkAccessFunc, Function *checkRangeFunc);
+
+        CallInst *insertCheck(Instruction *I, Value *ptr, Value *size, Function *checkAccessFunc);
+
+        bool isColdSite(Instruction *I);
 
         bool shouldInstrumentGlobal(GlobalVariable *G);
+
+        // The execution counts of the check sites, read from the -hm-profile-use profile, and the site IDs of the loads
+        // and stores of the current function.
+        DenseMap<uint64_t, uint64_t> Profile;
+        DenseMap<Instruction*, uint64_t> Sites;
+    };
+
+    // Lowers the __hmbounds_check calls left by DlibTestPass in -hm-early-checks mode (after the optimizations of the
+    // program) to the real checks, dropping the checks made redundant by the optimizations.
+    class HMBoundsLowerPass : public ModulePass {
+    public:
+        static char ID;
+        HMBoundsLowerPass() : ModulePass(ID) {}
+        virtual bool runOnModule(Module &M) override;
+        virtual void getAnalysisUsage(AnalysisUsage &AU) const override;
     };
 }
 
@@ -41,7 +158,651 @@ bool shouldInstrumentGlobal(GlobalVariable *G){
     return true;
 }
 
-bool DlibTestPass::instrumentFunction(Module &M, Function &F) {
+// A check site is identified by its function and the position of its access among the loads and stores of the function,
+// which is the same in the -hm-profile-gen and the -hm-profile-use build of a program. Functions with local linkage may
+// share their name with those of other translation units (e.g., static helpers), so their source file is included.
+static uint64_t getSiteId(Function &F, unsigned ordinal){
+    uint64_t hash = 14695981039346656037ULL;
+
+    if(F.hasLocalLinkage()){
+        for(char c : F.getParent()->getSourceFileName()){
+            hash = (hash ^ (unsigned char) c) * 1099511628211ULL;
+        }
+
+        hash = (hash ^ (unsigned char) ':') * 1099511628211ULL;
+    }
+
+    for(char c : F.getName()){
+        hash = (hash ^ (unsigned char) c) * 1099511628211ULL;
+    }
+
+    for(int i = 0; i < 4; i++){
+        hash = (hash ^ ((ordinal >> (8 * i)) & 0xFF)) * 1099511628211ULL;
+    }
+
+    // Never 0 (an empty slot in the runtime), nor one of the reserved keys of DenseMap.
+    return (hash >> 1) | 1;
+}
+
+// The pseudo check emitted in -hm-early-checks mode. It does not access memory and does not unwind, so the optimizations
+// treat it as a plain computation: GVN merges the checks of the same pointer, and LICM hoists the checks of loop invariant
+// pointers. It returns the checked pointer, which the access uses instead, so the check is kept (as long as the access is),
+// and stays ahead of it.
+static Function *getCheckPseudo(Module &M){
+    Function *F = M.getFunction("__hmbounds_check");
+    if(F){
+        return F;
+    }
+
+    LLVMContext &C = M.getContext();
+    Type *VoidPtrTy = Type::getInt8Ty(C)->getPointerTo();
+    FunctionType *FT = FunctionType::get(VoidPtrTy, {VoidPtrTy, Type::getInt32Ty(C)}, false);
+
+    F = Function::Create(FT, GlobalValue::ExternalLinkage, "__hmbounds_check", &M);
+    F->addFnAttr(Attribute::ReadNone);
+    F->addFnAttr(Attribute::NoUnwind);
+
+    return F;
+}
+
+// Make a load or store access the pointer returned by a pseudo check (offset bytes past the checked pointer).
+static void useCheckedPointer(Instruction *I, Value *checked, int64_t offset){
+    unsigned index = isa<LoadInst>(I) ? LoadInst::getPointerOperandIndex() : StoreInst::getPointerOperandIndex();
+
+    IRBuilder<> B(I);
+    Value *ptr = checked;
+    if(offset != 0){
+        ptr = B.CreateGEP(B.getInt8Ty(), ptr, B.getInt64(offset));
+    }
+
+    I->setOperand(index, B.CreateBitCast(ptr, I->getOperand(index)->getType()));
+}
+
+static bool isCheckPseudo(Instruction *I){
+    CallInst *CI = dyn_cast<CallInst>(I);
+    if(!CI || !CI->getCalledFunction()){
+        return false;
+    }
+
+    return CI->getCalledFunction()->getName() == "__hmbounds_check";
+}
+
+// The pointer accessed by a load or store (or checked by a pseudo check), and the amount of bytes checked for it.
+static Value *getAccessPointer(Instruction *I){
+    if(LoadInst *LI = dyn_cast<LoadInst>(I)){
+        return LI->getPointerOperand();
+    }
+
+    if(isCheckPseudo(I)){
+        return cast<CallInst>(I)->getArgOperand(0);
+    }
+
+    return cast<StoreInst>(I)->getPointerOperand();
+}
+
+static uint64_t getAccessSize(Instruction *I, const DataLayout &DL){
+    if(LoadInst *LI = dyn_cast<LoadInst>(I)){
+        return DL.getTypeAllocSize(LI->getType());
+    }
+
+    if(isCheckPseudo(I)){
+        return cast<ConstantInt>(cast<CallInst>(I)->getArgOperand(1))->getZExtValue();
+    }
+
+    return DL.getTypeAllocSize(cast<StoreInst>(I)->getValueOperand()->getType());
+}
+
+// Calls which may free memory. Intrinsics (memcpy, lifetime markers, debug info), functions which do not write memory
+// (such as the pseudo checks) and functions which only access memory inaccessible to the program never do.
+static bool mayFreeMemory(Instruction *I){
+    CallSite CS(I);
+    if(!CS || isa<IntrinsicInst>(I)){
+        return false;
+    }
+
+    return !CS.onlyReadsMemory() && !CS.onlyAccessesInaccessibleMemory();
+}
+
+static bool mayFreeInRange(BasicBlock::iterator Begin, BasicBlock::iterator End){
+    for(; Begin != End; ++Begin){
+        if(mayFreeMemory(&*Begin)){
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Whether memory may be freed on a path from the check at From to the access at To (dominated by From), which does not
+// pass From again (since From would check the pointer again).
+static bool mayFreeBetween(Instruction *From, Instruction *To){
+    BasicBlock *FromBB = From->getParent();
+    BasicBlock *ToBB = To->getParent();
+
+    if(FromBB == ToBB){
+        // From precedes To in the block, and every path entering the block again passes From first.
+        return mayFreeInRange(std::next(BasicBlock::iterator(From)), BasicBlock::iterator(To));
+    }
+
+    // The blocks between both: reachable from FromBB, and reaching ToBB, without passing FromBB.
+    SmallPtrSet<BasicBlock*, 16> Reachable;
+    SmallVector<BasicBlock*, 16> Stack(succ_begin(FromBB), succ_end(FromBB));
+
+    while(!Stack.empty()){
+        BasicBlock *BB = Stack.pop_back_val();
+        if(BB == FromBB || !Reachable.insert(BB).second){
+            continue;
+        }
+
+        Stack.append(succ_begin(BB), succ_end(BB));
+    }
+
+    SmallPtrSet<BasicBlock*, 16> Between;
+    Stack.append(pred_begin(ToBB), pred_end(ToBB));
+
+    while(!Stack.empty()){
+        BasicBlock *BB = Stack.pop_back_val();
+        if(BB == FromBB || !Reachable.count(BB) || !Between.insert(BB).second){
+            continue;
+        }
+
+        Stack.append(pred_begin(BB), pred_end(BB));
+    }
+
+    if(mayFreeInRange(std::next(BasicBlock::iterator(From)), FromBB->end())){
+        return true;
+    }
+
+    // ToBB is only scanned as a whole if it is part of a cycle between both, since the access may then be executed
+    // again after a call in its block.
+    if(!Between.count(ToBB) && mayFreeInRange(ToBB->begin(), BasicBlock::iterator(To))){
+        return true;
+    }
+
+    for(BasicBlock *BB : Between){
+        if(mayFreeInRange(BB->begin(), BB->end())){
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Whether the accesses of I in all iterations of its loop can be checked before the loop: the loop must only be left
+// through its latch, I must be executed on every iteration, and no call in the loop may free memory.
+static bool isHoistableAccess(Loop *L, Instruction *I, DominatorTree &DT){
+    BasicBlock *Latch = L->getLoopLatch();
+
+    if(!L->getLoopPreheader() || !Latch || L->getExitingBlock() != Latch || !DT.dominates(I->getParent(), Latch)){
+        return false;
+    }
+
+    for(BasicBlock *BB : L->blocks()){
+        if(mayFreeInRange(BB->begin(), BB->end())){
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Whether an access can never touch a red-zone: only heap objects are given red-zones, so accesses based on a stack
+// variable, a global variable or a constant (followed through pointer casts and GEPs) are left unchecked.
+static bool isNonHeapAccess(Instruction *I, const DataLayout &DL){
+    Value *Obj = GetUnderlyingObject(getAccessPointer(I), DL);
+
+    return isa<AllocaInst>(Obj) || isa<GlobalVariable>(Obj) || isa<Constant>(Obj);
+}
+
+void DlibTestPass::getAnalysisUsage(AnalysisUsage &AU) const {
+    AU.addRequired<DominatorTreeWrapperPass>();
+    AU.addRequired<LoopInfoWrapperPass>();
+    AU.addRequired<ScalarEvolutionWrapperPass>();
+}
+
+// Drop the checks of accesses at a (SCEV) offset from the result of an allocation call, which is provably within
+// [0, size - accessSize] for the (constant or SCEV-computable) size of the allocation. These can never reach a red-zone.
+void DlibTestPass::removeInBoundsChecks(Function &F, SmallVectorImpl<Instruction*> &WorkList, const DataLayout &DL){
+    ScalarEvolution &SE = getAnalysis<ScalarEvolutionWrapperPass>(F).getSE();
+
+    SmallVector<Instruction*, 16> Kept;
+    unsigned removed = 0;
+
+    for(Instruction *I : WorkList){
+        if(!isa<LoadInst>(I) && !isa<StoreInst>(I)){
+            Kept.push_back(I);
+            continue;
+        }
+
+        const SCEV *Ptr = SE.getSCEV(getAccessPointer(I));
+        const SCEVUnknown *Base = dyn_cast<SCEVUnknown>(SE.getPointerBase(Ptr));
+
+        AllocationSite AS;
+        Instruction *Allocation = Base ? dyn_cast<Instruction>(Base->getValue()) : nullptr;
+
+        if(!Allocation || !isAllocation(Allocation, AS) || !AS.isHeapAllocation()){
+            Kept.push_back(I);
+            continue;
+        }
+
+        const SCEV *Offset = SE.getMinusSCEV(Ptr, Base);
+        const SCEV *Size = SE.getTruncateOrZeroExtend(AS.getSizeSCEV(SE), Offset->getType());
+
+        // An offset changing in a loop is bounded by its values in the first and the last iteration.
+        const SCEV *Low = Offset;
+        const SCEV *High = Offset;
+
+        if(const SCEVAddRecExpr *AR = dyn_cast<SCEVAddRecExpr>(Offset)){
+            const SCEV *Count = SE.getBackedgeTakenCount(AR->getLoop());
+            const SCEVConstant *Step = dyn_cast<SCEVConstant>(AR->getStepRecurrence(SE));
+
+            if(AR->isAffine() && Step && !isa<SCEVCouldNotCompute>(Count) && (AR->hasNoUnsignedWrap() || AR->hasNoSignedWrap())){
+                Low = AR->getStart();
+                High = AR->evaluateAtIteration(Count, SE);
+
+                if(Step->getAPInt().isNegative()){
+                    std::swap(Low, High);
+                }
+            }
+        }
+
+        const SCEV *End = SE.getAddExpr(High, SE.getConstant(Offset->getType(), getAccessSize(I, DL)));
+
+        if(SE.isKnownNonNegative(Low) && SE.isKnownPredicate(ICmpInst::ICMP_ULE, End, Size)){
+            removed++;
+            continue;
+        }
+
+        Kept.push_back(I);
+    }
+
+    if(removed > 0){
+        NInBoundsChecks += removed;
+        DEBUG(dbgs() << F.getName() << ": " << removed << " checks removed as statically in-bounds\n");
+    }
+
+    WorkList.assign(Kept.begin(), Kept.end());
+}
+
+// Replace the checks of accesses at an affine address {start,+,step} in a loop with a computable trip count by a single
+// check of the range of all of their addresses, in the preheader of the loop.
+void DlibTestPass::hoistLoopChecks(Function &F, SmallVectorImpl<Instruction*> &WorkList, const DataLayout &DL,
+    Function *checkRangeFunc){
+    DominatorTree &DT = getAnalysis<DominatorTreeWrapperPass>(F).getDomTree();
+    LoopInfo &LI = getAnalysis<LoopInfoWrapperPass>(F).getLoopInfo();
+    ScalarEvolution &SE = getAnalysis<ScalarEvolutionWrapperPass>(F).getSE();
+
+    SCEVExpander Expander(SE, DL, "hmrange");
+    Type *IntPtrTy = DL.getIntPtrType(F.getContext());
+    Type *VoidPtrTy = Type::getInt8Ty(F.getContext())->getPointerTo();
+
+    // Accesses of the same loop covering the same range (e.g., a load and a store of a[i]) share a single range check. The
+    // range checks of different loops are kept apart, since one loop need not run after the other without a free between.
+    DenseSet<std::pair<BasicBlock*, std::pair<const SCEV*, const SCEV*>>> Inserted;
+    SmallVector<Instruction*, 16> Kept;
+
+    for(Instruction *I : WorkList){
+        Loop *L = LI.getLoopFor(I->getParent());
+
+        if((!isa<LoadInst>(I) && !isa<StoreInst>(I)) || L == nullptr || isColdSite(I)){
+            Kept.push_back(I);
+            continue;
+        }
+
+        const SCEVAddRecExpr *AR = dyn_cast<SCEVAddRecExpr>(SE.getSCEV(getAccessPointer(I)));
+        const SCEV *Count = SE.getBackedgeTakenCount(L);
+
+        if(!AR || AR->getLoop() != L || !AR->isAffine() || isa<SCEVCouldNotCompute>(Count) ||
+            !isa<SCEVConstant>(AR->getStepRecurrence(SE)) || !isHoistableAccess(L, I, DT)){
+            Kept.push_back(I);
+            continue;
+        }
+
+        // The range runs from the lowest to the highest address accessed, over Count + 1 iterations.
+        APInt Step = cast<SCEVConstant>(AR->getStepRecurrence(SE))->getAPInt();
+
+        const SCEV *Low = AR->getStart();
+        if(Step.isNegative()){
+            Low = AR->evaluateAtIteration(Count, SE);
+        }
+
+        const SCEV *Size = SE.getAddExpr(
+            SE.getMulExpr(SE.getTruncateOrZeroExtend(Count, IntPtrTy), SE.getConstant(IntPtrTy, Step.abs().getZExtValue())),
+            SE.getConstant(IntPtrTy, getAccessSize(I, DL)));
+
+        if(!isSafeToExpand(Low, SE) || !isSafeToExpand(Size, SE)){
+            Kept.push_back(I);
+            continue;
+        }
+
+        NHoistedChecks++;
+
+        if(!Inserted.insert(std::make_pair(L->getLoopPreheader(), std::make_pair(Low, Size))).second){
+            continue;
+        }
+
+        Instruction *InsertPt = L->getLoopPreheader()->getTerminator();
+
+        Value *ptr = Expander.expandCodeFor(Low, VoidPtrTy, InsertPt);
+        Value *size = Expander.expandCodeFor(Size, IntPtrTy, InsertPt);
+
+        IRBuilder<> B(InsertPt);
+        B.CreateCall(checkRangeFunc, {ptr, size});
+        NRangeChecks++;
+    }
+
+    WorkList.assign(Kept.begin(), Kept.end());
+}
+
+// Emit the check of an access of size bytes at ptr before I. For accesses of up to 8 bytes, the fast check is done inline:
+// their first and last byte are compared with the red-zone pattern, and only on a match the runtime is called (in a cold
+// block) for the slow check. Larger accesses are left to the runtime: the shadow memory runtime checks all of their bytes,
+// while the DHash runtime only compares their first and last byte with the pattern (finding every red-zone overlapped by an
+// access of at most the red-zone size). Returns the call to the runtime.
+static CallInst *emitCheck(Instruction *I, Value *ptr, Value *size, Function *checkAccessFunc){
+    uint64_t accessSize = cast<ConstantInt>(size)->getZExtValue();
+
+    if(!OptInlineFastPath || accessSize > 8){
+        IRBuilder<> B(I);
+        return B.CreateCall(checkAccessFunc, {ptr, size});
+    }
+
+    LLVMContext &C = I->getContext();
+    Type *Int8Ty = Type::getInt8Ty(C);
+
+    IRBuilder<> B(I);
+    Value *pattern = ConstantInt::get(Int8Ty, OptRedzonePattern);
+    Value *match = B.CreateICmpEQ(B.CreateLoad(Int8Ty, ptr), pattern);
+
+    if(accessSize > 1){
+        Value *last = B.CreateGEP(Int8Ty, ptr, B.getInt64(accessSize - 1));
+        match = B.CreateOr(match, B.CreateICmpEQ(B.CreateLoad(Int8Ty, last), pattern));
+    }
+
+    // The pattern is rarely found outside of red-zones, so the call is moved out of the way of the access.
+    MDNode *weights = MDBuilder(C).createBranchWeights(1, 100000);
+    Instruction *slowPath = SplitBlockAndInsertIfThen(match, I, false, weights);
+
+    IRBuilder<> SlowB(slowPath);
+    NInlineChecks++;
+
+    return SlowB.CreateCall(checkAccessFunc, {ptr, size});
+}
+
+// Emit a check which only runs once in every __hmbounds_sample_rate (a runtime variable) executions of its site, counted
+// down per thread. Once a check of the site found a red-zone access, the site is checked on every execution.
+static void emitSampledCheck(Instruction *I, Value *ptr, Value *size, Function *checkAccessFunc){
+    Module &M = *I->getModule();
+    LLVMContext &C = M.getContext();
+    Type *Int8Ty = Type::getInt8Ty(C);
+    Type *Int32Ty = Type::getInt32Ty(C);
+
+    GlobalVariable *count = new GlobalVariable(M, Int32Ty, false, GlobalValue::InternalLinkage,
+        ConstantInt::get(Int32Ty, 0), "__hmbounds_count", nullptr, GlobalValue::GeneralDynamicTLSModel);
+    GlobalVariable *fired = new GlobalVariable(M, Int8Ty, false, GlobalValue::InternalLinkage,
+        ConstantInt::get(Int8Ty, 0), "__hmbounds_fired");
+    Constant *rate = M.getOrInsertGlobal("__hmbounds_sample_rate", Int32Ty);
+
+    IRBuilder<> B(I);
+    Value *left = B.CreateSub(B.CreateLoad(Int32Ty, count), B.getInt32(1));
+    B.CreateStore(left, count);
+
+    MDNode *weights = MDBuilder(C).createBranchWeights(1, 100);
+    Instruction *sample = SplitBlockAndInsertIfThen(B.CreateICmpSLT(left, B.getInt32(0)), I, false, weights);
+
+    CallInst *check = emitCheck(sample, ptr, size, checkAccessFunc);
+
+    IRBuilder<> CheckB(check->getNextNode());
+    Value *hit = CheckB.CreateZExt(CheckB.CreateICmpNE(check, ConstantInt::get(check->getType(), 0)), Int8Ty);
+    CheckB.CreateStore(CheckB.CreateOr(CheckB.CreateLoad(Int8Ty, fired), hit), fired);
+
+    // The countdown restarts at the sample rate, or at 0 (checking the next execution again) once the site fired.
+    IRBuilder<> SampleB(sample);
+    Value *once = SampleB.CreateICmpNE(SampleB.CreateLoad(Int8Ty, fired), SampleB.getInt8(0));
+    Value *rateLeft = SampleB.CreateSub(SampleB.CreateLoad(Int32Ty, rate), SampleB.getInt32(1));
+    SampleB.CreateStore(SampleB.CreateSelect(once, SampleB.getInt32(0), rateLeft), count);
+
+    NSampledChecks++;
+}
+
+static void emitSiteCheck(Instruction *I, Value *ptr, Value *size, Function *checkAccessFunc){
+    if(OptSampleChecks){
+        emitSampledCheck(I, ptr, size, checkAccessFunc);
+        return;
+    }
+
+    emitCheck(I, ptr, size, checkAccessFunc);
+}
+
+// With a profile, the sites executed less than OptHotThreshold times (including those never executed) are cold.
+bool DlibTestPass::isColdSite(Instruction *I){
+    if(OptProfileUse.empty() || !Sites.count(I)){
+        return false;
+    }
+
+    auto It = Profile.find(Sites[I]);
+
+    return It == Profile.end() || It->second < OptHotThreshold;
+}
+
+// Insert the check of an access of size bytes at ptr before I (sampled in -hm-sample-checks mode), or a pseudo check in
+// -hm-early-checks mode. Cold sites are checked by a plain call to the runtime, keeping them small. Returns the pseudo
+// check, of which the caller must make the checked accesses use the result (see useCheckedPointer).
+CallInst *DlibTestPass::insertCheck(Instruction *I, Value *ptr, Value *size, Function *checkAccessFunc){
+    if(OptEarlyChecks){
+        IRBuilder<> B(I);
+        return B.CreateCall(getCheckPseudo(*I->getModule()), {ptr, size});
+    }
+
+    if(isColdSite(I)){
+        IRBuilder<> B(I);
+        B.CreateCall(checkAccessFunc, {ptr, size});
+        NColdChecks++;
+        return nullptr;
+    }
+
+    emitSiteCheck(I, ptr, size, checkAccessFunc);
+
+    return nullptr;
+}
+
+// Drop the checks of loads and stores (or pseudo checks) dominated by a check of the same pointer, of at least the same
+// size, without a call that may free memory in between. The first check already detects any access to a red-zone.
+static void removeRedundantChecks(SmallVectorImpl<Instruction*> &WorkList, DominatorTree &DT, const DataLayout &DL){
+    DenseMap<Value*, SmallVector<Instruction*, 4>> Checked;
+    SmallVector<Instruction*, 16> Kept;
+
+    for(Instruction *I : WorkList){
+        if(!isa<LoadInst>(I) && !isa<StoreInst>(I) && !isCheckPseudo(I)){
+            Kept.push_back(I);
+            continue;
+        }
+
+        Value *ptr = getAccessPointer(I)->stripPointerCasts();
+        uint64_t size = getAccessSize(I, DL);
+
+        bool redundant = false;
+        for(Instruction *Prev : Checked[ptr]){
+            if(getAccessSize(Prev, DL) >= size && DT.dominates(Prev, I) && !mayFreeBetween(Prev, I)){
+                redundant = true;
+                break;
+            }
+        }
+
+        if(redundant){
+            NRedundantChecks++;
+            continue;
+        }
+
+        Checked[ptr].push_back(I);
+        Kept.push_back(I);
+    }
+
+    WorkList.assign(Kept.begin(), Kept.end());
+}
+
+// Replace the checks of accesses at constant offsets from the same base pointer in a basic block (e.g., the fields of a
+// struct) by a single check of [lowest offset, highest offset + size), before the first of them. A group is closed at a
+// call that may free memory, and when it would span more than OptCoalesceMaxSpan bytes. The bytes in between the accesses
+// may lie in a red-zone (e.g., when one of the accesses overflows its object), so a check comparing only the first and last
+// byte with the pattern is not enough: groups of more than 8 bytes are checked with the range check, which scans every byte.
+void DlibTestPass::coalesceChecks(Function &F, SmallVectorImpl<Instruction*> &WorkList, const DataLayout &DL,
+    Function *checkAccessFunc, Function *checkRangeFunc){
+    struct CheckGroup {
+        Value *Base;
+        int64_t Low;
+        int64_t High;
+        SmallVector<Instruction*, 4> Members;
+    };
+
+    SmallPtrSet<Instruction*, 16> Checked;
+    for(Instruction *I : WorkList){
+        if(isa<LoadInst>(I) || isa<StoreInst>(I)){
+            Checked.insert(I);
+        }
+    }
+
+    SmallVector<CheckGroup, 16> Groups;
+
+    for(BasicBlock &BB : F){
+        DenseMap<Value*, unsigned> Open;
+
+        for(Instruction &I : BB){
+            if(mayFreeMemory(&I)){
+                Open.clear();
+                continue;
+            }
+
+            if(!Checked.count(&I)){
+                continue;
+            }
+
+            int64_t Offset = 0;
+            Value *Base = GetPointerBaseWithConstantOffset(getAccessPointer(&I), Offset, DL);
+            int64_t End = Offset + getAccessSize(&I, DL);
+
+            auto It = Open.find(Base);
+            if(It != Open.end()){
+                CheckGroup &G = Groups[It->second];
+                int64_t Low = std::min(G.Low, Offset);
+                int64_t High = std::max(G.High, End);
+
+                if(High - Low <= (int64_t) OptCoalesceMaxSpan){
+                    G.Low = Low;
+                    G.High = High;
+                    G.Members.push_back(&I);
+                    continue;
+                }
+            }
+
+            CheckGroup G;
+            G.Base = Base;
+            G.Low = Offset;
+            G.High = End;
+            G.Members.push_back(&I);
+
+            Open[Base] = Groups.size();
+            Groups.push_back(G);
+        }
+    }
+
+    LLVMContext &C = F.getContext();
+    Type *Int8Ty = Type::getInt8Ty(C);
+    Type *Int32Ty = Type::getInt32Ty(C);
+    Type *Int64Ty = Type::getInt64Ty(C);
+
+    SmallPtrSet<Instruction*, 16> Merged;
+
+    for(CheckGroup &G : Groups){
+        if(G.Members.size() < 2){
+            continue;
+        }
+
+        // The members are in program order, so the first one precedes (and its base dominates) all others.
+        Instruction *First = G.Members.front();
+
+        IRBuilder<> B(First);
+        Value *ptr = B.CreateGEP(Int8Ty, B.CreateBitCast(G.Base, Int8Ty->getPointerTo()), B.getInt64(G.Low));
+
+        // A red-zone is at least 8 bytes long, so a group of up to 8 bytes overlapping one has its first or last byte in it.
+        if(G.High - G.Low <= 8){
+            CallInst *pseudo = insertCheck(First, ptr, ConstantInt::get(Int32Ty, G.High - G.Low), checkAccessFunc);
+
+            if(pseudo){
+                for(Instruction *Member : G.Members){
+                    int64_t Offset = 0;
+                    GetPointerBaseWithConstantOffset(getAccessPointer(Member), Offset, DL);
+                    useCheckedPointer(Member, pseudo, Offset - G.Low);
+                }
+            }
+        }else{
+            B.CreateCall(checkRangeFunc, {ptr, ConstantInt::get(Int64Ty, G.High - G.Low)});
+        }
+
+        Merged.insert(G.Members.begin(), G.Members.end());
+        NCoalescedChecks += G.Members.size();
+        NChecks += G.Members.size();
+        NWideChecks++;
+    }
+
+    SmallVector<Instruction*, 16> Kept;
+    for(Instruction *I : WorkList){
+        if(!Merged.count(I)){
+            Kept.push_back(I);
+        }
+    }
+
+    WorkList.assign(Kept.begin(), Kept.end());
+}
+
+// Make F run its unchecked clone while checks are disabled for the current thread: a new entry block tests the flag of the
+// runtime, and tail-calls the clone if it is clear. Static allocas are moved along to the new entry block.
+static void insertCheckDispatch(Function &F, Function *Unchecked){
+    Module &M = *F.getParent();
+    LLVMContext &C = M.getContext();
+    Type *Int32Ty = Type::getInt32Ty(C);
+
+    Constant *enabled = M.getOrInsertGlobal("__hmbounds_checks_enabled", Int32Ty);
+    if(GlobalVariable *G = dyn_cast<GlobalVariable>(enabled)){
+        G->setThreadLocal(true);
+    }
+
+    BasicBlock *Entry = &F.getEntryBlock();
+    BasicBlock *Dispatch = BasicBlock::Create(C, "hmdispatch", &F, Entry);
+    BasicBlock *UncheckedBB = BasicBlock::Create(C, "hmunchecked", &F);
+
+    for(BasicBlock::iterator It = Entry->begin(); It != Entry->end();){
+        AllocaInst *AI = dyn_cast<AllocaInst>(&*It++);
+        if(AI && isa<Constant>(AI->getArraySize())){
+            AI->removeFromParent();
+            Dispatch->getInstList().push_back(AI);
+        }
+    }
+
+    IRBuilder<> B(Dispatch);
+    Value *on = B.CreateICmpNE(B.CreateLoad(Int32Ty, enabled), B.getInt32(0));
+    B.CreateCondBr(on, Entry, UncheckedBB);
+
+    SmallVector<Value*, 8> arguments;
+    for(Argument &A : F.args()){
+        arguments.push_back(&A);
+    }
+
+    IRBuilder<> UB(UncheckedBB);
+    CallInst *CI = UB.CreateCall(Unchecked, arguments);
+    CI->setCallingConv(Unchecked->getCallingConv());
+    // The clone has the parameter attributes of F, which the call must match (byval, sret, inalloca, zeroext, ...).
+    CI->setAttributes(F.getAttributes());
+    CI->setTailCall();
+
+    if(F.getReturnType()->isVoidTy()){
+        UB.CreateRetVoid();
+    }else{
+        UB.CreateRet(CI);
+    }
+}
+
+bool DlibTestPass::instrumentFunction(Module &M, Function &F, bool checkAccesses) {
     // TO-DO:
     // - For every alloca, put the allocated variable/array/struct inside another struct
     //  with two arrays inside it as well (front and rear red-zones). Make sure the new struct
@@ -66,6 +827,9 @@ bool DlibTestPass::instrumentFunction(Module &M, Function &F) {
     // Does a fast check for the magic pattern, or a slow check in the shadow memory/hash table. 
     Function *checkAccessFunc = cast<Function>(M.getOrInsertFunction("checkMemoryAccess", Int32Ty, VoidPtrTy, Int32Ty, SENTINEL));
 
+    // Checks a whole range of memory at once, used for the accesses of a loop.
+    Function *checkRangeFunc = cast<Function>(M.getOrInsertFunction("checkMemoryRange", Int32Ty, VoidPtrTy, Int64Ty, SENTINEL));
+
     // All dynamic memory allocation wrapper functions. Might need something for posix_memalign
     // and potentially alloca.
     Function *newMalloc = cast<Function>(M.getOrInsertFunction("Dlib_malloc", VoidPtrTy, Int64Ty, SENTINEL));
@@ -76,13 +840,27 @@ bool DlibTestPass::instrumentFunction(Module &M, Function &F) {
     // The wrapped free function.
     Function *newFree = cast<Function>(M.getOrInsertFunction("Dlib_free", VoidTy, VoidPtrTy, SENTINEL));
 
+    // Counts the executions of a check site, for the profile.
+    Function *countSiteFunc = cast<Function>(M.getOrInsertFunction("countCheckSite", VoidTy, Int64Ty, SENTINEL));
+
     DataLayout DL = M.getDataLayout();
 
     SmallVector<Instruction*, 16> WorkList;
+    SmallVector<Instruction*, 16> Counted;
+    unsigned ordinal = 0;
+
+    Sites.clear();
 
     for(Instruction &I : instructions(F)){
-        if(isa<LoadInst>(&I) || isa<StoreInst>(&I)){
-            WorkList.push_back(&I);
+        if(checkAccesses && (isa<LoadInst>(&I) || isa<StoreInst>(&I))){
+            Sites[&I] = getSiteId(F, ordinal++);
+
+            if(OptSkipNonHeap && isNonHeapAccess(&I, DL)){
+                NNonHeapAccesses++;
+            }else{
+                WorkList.push_back(&I);
+                Counted.push_back(&I);
+            }
         }
 
         // Do something special if calls to either these functions are called in
@@ -107,6 +885,32 @@ bool DlibTestPass::instrumentFunction(Module &M, Function &F) {
         }
     }
 
+    if(OptInBoundsChecks){
+        removeInBoundsChecks(F, WorkList, DL);
+    }
+
+    if(OptHoistLoopChecks){
+        hoistLoopChecks(F, WorkList, DL, checkRangeFunc);
+    }
+
+    if(OptRedundantChecks){
+        removeRedundantChecks(WorkList, getAnalysis<DominatorTreeWrapperPass>(F).getDomTree(), DL);
+    }
+
+    if(OptCoalesceChecks){
+        coalesceChecks(F, WorkList, DL, checkAccessFunc, checkRangeFunc);
+    }
+
+    // All sites are counted, including those of which the check was removed (or hoisted), since whether a check is needed
+    // does not depend on the profile.
+    if(OptProfileGen){
+        for(Instruction *I : Counted){
+            IRBuilder<> B(I);
+            B.CreateCall(countSiteFunc, {B.getInt64(Sites[I])});
+            NProfiledSites++;
+        }
+    }
+
     IRBuilder<> B(F.getContext());
     for(Instruction *I : WorkList){
         B.SetInsertPoint(I);
@@ -117,14 +921,20 @@ bool DlibTestPass::instrumentFunction(Module &M, Function &F) {
             Value *ptr = B.CreateBitCast(LI->getPointerOperand(), VoidPtrTy);
 	    Value *newint = ConstantInt::get(Int32Ty, DL.getTypeAllocSize(LI->getType()));
 
-            B.CreateCall(checkAccessFunc, {ptr, newint});
+            if(CallInst *pseudo = insertCheck(I, ptr, newint, checkAccessFunc)){
+                useCheckedPointer(I, pseudo, 0);
+            }
+            NChecks++;
         }else if(StoreInst *SI = dyn_cast<StoreInst>(I)){
             IRBuilder<> B(SI);
 
             Value *ptr = B.CreateBitCast(SI->getPointerOperand(), VoidPtrTy);
 	    Value *newint = ConstantInt::get(Int32Ty, DL.getTypeAllocSize(SI->getOperand(0)->getType()));
 
-            B.CreateCall(checkAccessFunc, {ptr, newint});
+            if(CallInst *pseudo = insertCheck(I, ptr, newint, checkAccessFunc)){
+                useCheckedPointer(I, pseudo, 0);
+            }
+            NChecks++;
         }else if(CallInst* CI = dyn_cast<CallInst>(I)){
             Function *func = CI->getCalledFunction();
 
@@ -274,9 +1084,46 @@ bool DlibTestPass::instrumentFunction(Module &M, Function &F) {
 bool DlibTestPass::runOnModule(Module &M) {
     bool IRModify = false;
 
+    if(!OptProfileUse.empty()){
+        std::ifstream file(OptProfileUse.c_str());
+        if(!file.good()){
+            errs() << "Error: could not read check site profile " << OptProfileUse << "\n";
+            exit(1);
+        }
+
+        // Lines of "<site> <executions>", as written by the runtime. Every run appends its counts, so a site may have several.
+        uint64_t site;
+        uint64_t count;
+        while(file >> std::hex >> site >> std::dec >> count){
+            Profile[site] += count;
+        }
+    }
+
+    // The functions are collected first, since the clones are added to the module.
+    SmallVector<Function*, 16> Functions;
     for (Function &F : M) {
-        if (!(F.isDeclaration())){
-            IRModify |= instrumentFunction(M, F);
+        if (!F.isDeclaration()){
+            Functions.push_back(&F);
+        }
+    }
+
+    for (Function *F : Functions) {
+        // The clone only has its allocations and deallocations replaced, since its objects are shared with the checked
+        // functions. Variadic functions cannot forward their arguments, so they are always checked.
+        if(OptCloneUnchecked && !F->isVarArg()){
+            ValueToValueMapTy VMap;
+            Function *Unchecked = CloneFunction(F, VMap);
+            Unchecked->setName(F->getName() + ".unchecked");
+            Unchecked->setLinkage(GlobalValue::InternalLinkage);
+
+            instrumentFunction(M, *Unchecked, false);
+            IRModify |= instrumentFunction(M, *F, true);
+
+            insertCheckDispatch(*F, Unchecked);
+            NUncheckedClones++;
+            IRModify = true;
+        }else{
+            IRModify |= instrumentFunction(M, *F, true);
         }
     }
 
@@ -285,3 +1132,59 @@ bool DlibTestPass::runOnModule(Module &M) {
 
 char DlibTestPass::ID = 0;
 static RegisterPass<DlibTestPass> X("hmboundsdhashpass", "A memory bounds checking pass used by the HM-BoundsChecking and DHash frameworks.");
+
+void HMBoundsLowerPass::getAnalysisUsage(AnalysisUsage &AU) const {
+    AU.addRequired<DominatorTreeWrapperPass>();
+}
+
+bool HMBoundsLowerPass::runOnModule(Module &M) {
+    Function *pseudo = M.getFunction("__hmbounds_check");
+    if(!pseudo){
+        return false;
+    }
+
+    LLVMContext &C = M.getContext();
+    Function *checkAccessFunc = cast<Function>(M.getOrInsertFunction("checkMemoryAccess", Type::getInt32Ty(C),
+        Type::getInt8Ty(C)->getPointerTo(), Type::getInt32Ty(C), SENTINEL));
+    DataLayout DL = M.getDataLayout();
+
+    for(Function &F : M){
+        if(F.isDeclaration()){
+            continue;
+        }
+
+        SmallVector<Instruction*, 16> WorkList;
+        for(Instruction &I : instructions(F)){
+            if(isCheckPseudo(&I)){
+                WorkList.push_back(&I);
+            }
+        }
+
+        if(WorkList.empty()){
+            continue;
+        }
+
+        // The optimizations (e.g., GVN and LICM) may have made checks of the same pointer dominate each other.
+        SmallVector<Instruction*, 16> Kept(WorkList.begin(), WorkList.end());
+        removeRedundantChecks(Kept, getAnalysis<DominatorTreeWrapperPass>(F).getDomTree(), DL);
+
+        for(Instruction *I : Kept){
+            CallInst *CI = cast<CallInst>(I);
+            emitSiteCheck(CI, CI->getArgOperand(0), CI->getArgOperand(1), checkAccessFunc);
+            NLoweredChecks++;
+        }
+
+        // The accesses use the checked pointer returned by the pseudo checks.
+        for(Instruction *I : WorkList){
+            I->replaceAllUsesWith(cast<CallInst>(I)->getArgOperand(0));
+            I->eraseFromParent();
+        }
+    }
+
+    pseudo->eraseFromParent();
+
+    return true;
+}
+
+char HMBoundsLowerPass::ID = 0;
+static RegisterPass<HMBoundsLowerPass> Y("hmboundslowerpass", "Lowers the early checks of the HM-BoundsChecking and DHash pass.");
@@ -9,12 +9,22 @@
 #include <malloc.h>
 #include <pthread.h>
 #include <errno.h>
+#include <sched.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
 
-#define AMOUNT_OF_LOCKS 2
+//Amount of locks protecting the buckets of the hash table (bucket N is protected by lock N % AMOUNT_OF_LOCKS). Must be a
+//power of two, and not larger than HASHSZ.
+#define AMOUNT_OF_LOCKS 1024
 
-//test for how many locks are useful. Write about in paper when found, and say that we did research into which
-//amount is optimal for naive locking.
-int busyCounter = 0;
+//Amount of attempts to acquire a contended lock by spinning, before the thread is parked until the lock is released.
+#define LOCK_SPIN_LIMIT 128
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CPU_RELAX() __builtin_ia32_pause()
+#else
+#define CPU_RELAX() __asm__ __volatile__("" ::: "memory")
+#endif
 
 //Originally used for the size of the shadow memory. A left-over from the ASAN implementation, but now used to calculate
 //the red-zone size dynamically. For scale value N, the red-zone size will be 2 ^ N (e.g., N = 3, 2 ^ 3 = 8 bytes).
@@ -26,21 +36,84 @@ size_t scale = 7;
 //for this, but can be changed to anything (as long as it is 8 bits/1 byte long).
 unsigned char redzone = 0xFF;
 
+//A check site instrumented with -hm-sample-checks is checked once in every __hmbounds_sample_rate executions (and on every
+//execution once it found a red-zone access). Can be set at start-up with the HMBOUNDS_SAMPLE_RATE environment variable.
+int __hmbounds_sample_rate = SAMPLE_RATE;
+
+//Checks are only done while __hmbounds_checks_enabled is set for the thread, in programs instrumented with
+//-hm-clone-unchecked (where every function runs an unchecked copy of itself while it is clear).
+__thread int __hmbounds_checks_enabled = 1;
+
 //Exponent for the address hashing pre-calculated to avoid having to do the calculation all the time.
 unsigned long int exponent = 0;
 
 //Size of the red-zone, determined by the scale variable.
 static size_t rz_sz = 0;
 
-rzHashBucket hashTable[HASHSZ];
+//The initial hash table, used until the table first grows.
+static rzHashBucket initialHashTable[HASHSZ];
+
+//The state of the hash table (its buckets, and those of an ongoing rehash). The 'slow' check reads it without acquiring
+//any locks, so it is replaced as a whole (apart from its rehash index) when a rehash starts or finishes.
+static rzTableState initialTableState = {initialHashTable, HASHSZ, NULL, 0, 0};
+static rzTableState *tableState = &initialTableState;
+
+//The global epoch, and the records of all threads that have accessed the hash table. Memory unlinked from the table
+//(arrays, tables and states) is only freed once all readers have passed through two epochs since.
+static unsigned long int globalEpoch = 0;
+static epochRecord *epochRecords = NULL;
+
+//The record of the current thread, and the memory it retired which has not yet been freed.
+static __thread epochRecord *threadRecord = NULL;
+static __thread retiredMemory retired[RETIRE_LIMIT];
+static __thread int retiredCount = 0;
+
+//Used to release the record of a thread on its exit.
+static pthread_key_t epochKey;
+static pthread_once_t epochKeyOnce = PTHREAD_ONCE_INIT;
+
+//Free arrays of entries cached by the current thread, per size class. Arrays are taken from (and freed to) this cache,
+//so registering an object normally does not call malloc().
+static __thread entryCache entryCaches[ENTRY_CLASSES];
+
+//Batches of free arrays of entries returned by threads with a full cache (or by exiting threads), per size class.
+static freeEntry *entryPool[ENTRY_CLASSES];
+static pthread_mutex_t entryPoolMutex = PTHREAD_MUTEX_INITIALIZER;
+
+//Amount of registered objects, used for the load factor of the table.
+static unsigned long int registeredAddrs = 0;
+
+//Increased on every removal, invalidating the objects cached by all threads.
+static unsigned long int removalGeneration = 0;
+
+//Objects recently found by the 'slow' check of the current thread, valid for the removal generation hitGeneration.
+static __thread rzAddr hitCache[HIT_CACHE_SIZE];
+static __thread unsigned long int hitGeneration = 0;
+static __thread int hitCount = 0;
+static __thread int hitNext = 0;
+
+//Deallocations of the current thread of which the removal (and the free()) is deferred to the next batch.
+static __thread rzAddr removalLog[REMOVAL_LOG_SIZE];
+static __thread int removalCount = 0;
+
+//Whether the removal log of the thread calling exit() is flushed at exit. Threads flush theirs when they exit, but the
+//main thread (or any thread calling exit()) does not run the destructor of its epoch record.
+static int exitHandler = 0;
+
+//Whether the fork handlers are installed.
+static int forkHandlers = 0;
 
 static int init = 0;
 
 //Used to create a mapping from virtual memory addresses to the hash table buckets.
 static unsigned long int pagesz = 0;
 
-//An array of mutexes, created to ensure thread safety when performing operations on the hash table and its buckets.
-pthread_mutex_t mutexes[AMOUNT_OF_LOCKS];
+//The locks, created to ensure thread safety when performing operations on the hash table and its buckets. A zeroed lock is
+//unlocked, so they need no initialisation.
+bucketLock locks[AMOUNT_OF_LOCKS];
+
+//Ensures only one thread at a time moves buckets during a rehash.
+pthread_mutex_t rehashMutex = PTHREAD_MUTEX_INITIALIZER;
 
 /*----------------Environment Variables----------------*/
 
@@ -50,6 +123,7 @@ pthread_mutex_t mutexes[AMOUNT_OF_LOCKS];
 //Variable for activating red-zone poison pattern checking. Deactivating this option will also disable all
 //red-zone pattern insertion, meaning red-zones will no longer be explicitly poisoned. Only the 'slow' check will be used here,
 //resulting in a performance decrease, but an increase in memory efficiency (since the red-zones will no longer be intialised).
+//Programs instrumented with the inline fast path of the pass (-hm-inline-fast-path, on by default) require this option.
 static int fastCheckInit = 0;
 
 //Variable for enabling hash table registration. If disabled, registration will be turned off, and only the explicit poisoning of
@@ -57,6 +131,29 @@ static int fastCheckInit = 0;
 //but will probably increase performance as well. 
 static int useRegistration = 0;
 
+//Variable for enabling the resizing of the hash table. If enabled, the table grows (and shrinks) with the amount of registered
+//objects, moving a few buckets at a time on every registration/removal. If disabled, the table keeps HASHSZ buckets, and the
+//cost of a 'slow' check grows with the size of the heap.
+static int useRehash = 0;
+
+//Variable for enabling the per-thread cache of recently found objects. If enabled, repeated 'slow' checks of the same objects
+//(e.g., a loop over data holding the red-zone pattern) are answered without searching the hash table, until any object is
+//removed.
+static int useHitCache = 0;
+
+//Variable for enabling deferred removals. If enabled, every thread logs its deallocations, and applies their removals in
+//batches of REMOVAL_LOG_SIZE, sorted on the lock of their bucket (taking every lock once per batch). The memory is only
+//freed once its batch is applied, so its red-zones stay poisoned and registered until then.
+static int useDeferredRemoval = 1;
+
+//Hash function used to map the page numbers of red-zone addresses to buckets: HASH_XOR_FOLD, HASH_FIBONACCI or HASH_CRC32C
+//(which uses the SSE4.2 instruction when compiled with -msse4.2). See Tests/HashBenchmark.c for a comparison.
+static int hashFunction = HASH_FIBONACCI;
+
+//Granularity at which red-zone addresses are keyed into the hash table, as the log2 of the size of a 'page' (8 for 256 bytes,
+//up to 16 for 64KB). Set to 0 to use the system page size.
+static unsigned long int granularity = 0;
+
 //OPTIONS:
 //Both enabled (a fast check, using a hash table for the slow check).
 //Only the hash table enabled (only a slow check, no explicitly poisoned red-zones).
@@ -80,11 +177,9 @@ size_t calcRZSize(size_t scale){
 }
 
 int unloadLib(){
-	/* Function to destroy the mutexes, and to ensure the library cannot function properly any more. This is only necessary
-	   on dynamic library unloads (probably). */
-	for(int i = 0; i < AMOUNT_OF_LOCKS; i++){
-		pthread_mutex_destroy(&mutexes[i]);
-	}
+	/* Function to ensure the library cannot function properly any more. This is only necessary on dynamic library
+	   unloads (probably). The deferred removals of the calling thread are applied first. */
+	flushRemovalLog();
 
 	init = 0;
 
@@ -93,6 +188,12 @@ int unloadLib(){
 
 int initLib(){
 	/* Function to set up some necessary variables/values. Called upon the use of any (callable) function. */
+	char *sampleRate;
+	sampleRate = getenv("HMBOUNDS_SAMPLE_RATE");
+	if(sampleRate != NULL && atoi(sampleRate) > 0){
+		__hmbounds_sample_rate = atoi(sampleRate);
+	}
+
 	if(useRegistration == 0){
 		pagesz = sysconf(_SC_PAGESIZE);
 		if(pagesz == 0){
@@ -106,13 +207,36 @@ int initLib(){
 		return 1;
 	}
 	
-	exponent = log(pagesz) / log(2);
+	if(granularity != 0){
+		exponent = granularity;
+	}else{
+		exponent = log(pagesz) / log(2);
+	}
 
-	for(int i = 0; i < AMOUNT_OF_LOCKS; i++){
-		if(pthread_mutex_init(&mutexes[i], NULL) != 0){
-			printf("ERROR: FAILED TO INITIALISE MUTEXES.\n");
+	/* Entries store their offset in the page in 16 bits, and a red-zone may span at most two pages. */
+	if(exponent < 8 || exponent > 16 || (1UL << exponent) < rz_sz){
+		printf("ERROR: UNSUPPORTED HASH TABLE GRANULARITY.\n");
+		return 1;
+	}
+
+	if(forkHandlers == 0){
+		/* Handlers cannot be removed again, so only install them on the first initialisation. */
+		if(pthread_atfork(prepareFork, parentFork, childFork) != 0){
+			printf("ERROR: FAILED TO INSTALL FORK HANDLERS.\n");
+			return 1;
+		}
+
+		forkHandlers = 1;
+	}
+
+	if(useDeferredRemoval == 0 && exitHandler == 0){
+		/* Handlers cannot be removed again, so only register it on the first initialisation. */
+		if(atexit(flushRemovalLog) != 0){
+			printf("ERROR: FAILED TO REGISTER THE REMOVAL LOG FLUSH.\n");
 			return 1;
 		}
+
+		exitHandler = 1;
 	}
 
 	init = 1;
@@ -120,14 +244,59 @@ int initLib(){
 	return 0;
 }
 
-int getLock(int bucket){
-	if(bucket < 2048){
-		return 0;
-	}else if(bucket >= 2048 && bucket < 4096){
+int getLock(unsigned long int hash){
+	/* The locks are striped on the lowest bits of the hash. Since the table never shrinks below AMOUNT_OF_LOCKS buckets,
+	   an address maps to the same lock in the old and the new table during a rehash. */
+	return (int) (hash & (AMOUNT_OF_LOCKS - 1));
+}
+
+int lockStripe(int stripe){
+	int *state;
+	state = &locks[stripe].state;
+
+	/* Buckets are only held for a short time, so first spin for a bounded amount of attempts. Only try to take the lock
+	   once it looks free, to avoid bouncing its cache line between the waiting threads. */
+	for(int i = 0; i < LOCK_SPIN_LIMIT; i++){
+		if(__atomic_load_n(state, __ATOMIC_RELAXED) == 0){
+			int expected;
+			expected = 0;
+
+			if(__atomic_compare_exchange_n(state, &expected, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)){
+				return 0;
+			}
+		}
+
+		CPU_RELAX();
+	}
+
+	/* Park the thread until the lock is released. Marking the lock as contended (2) makes the holder wake a thread
+	   when it unlocks. */
+	while(__atomic_exchange_n(state, 2, __ATOMIC_ACQUIRE) != 0){
+		if(syscall(SYS_futex, state, FUTEX_WAIT_PRIVATE, 2, NULL, NULL, 0) == -1 && errno != EAGAIN && errno != EINTR){
+			printf("ERROR: FAILED TO WAIT FOR LOCK.\n");
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+int unlockStripe(int stripe){
+	int *state;
+	state = &locks[stripe].state;
+
+	int previous;
+	previous = __atomic_exchange_n(state, 0, __ATOMIC_RELEASE);
+
+	if(previous == 0){
+		printf("ERROR: LOCK TO BE UNLOCKED WAS NOT LOCKED.\n");
 		return 1;
+	}else if(previous == 2){
+		/* Wake a parked thread. */
+		syscall(SYS_futex, state, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
 	}
 
-	return -1;
+	return 0;
 }
 
 int unlock(void *mem){
@@ -136,104 +305,403 @@ int unlock(void *mem){
 		return 1;
 	}
 
-	int bucket;
-	bucket = getRZAddrBucket(mem);
+	return unlockStripe(getLock(getRZAddrHash(mem)));
+}
+
+int lock(void *mem){
+	if(mem == NULL){
+		printf("ERROR: ADDRESS GIVEN TO FUNCTION 'lock' WAS NOT VALID.\n");
+		return 1;
+	}
+
+	return lockStripe(getLock(getRZAddrHash(mem)));
+}
 
-	int lock;
-	lock = -1;
+int lockPair(void *memL, void *memR){
+	/* Locks are always acquired in increasing order, so two threads taking the same pair of locks cannot deadlock. */
+	int first;
+	first = getLock(getRZAddrHash(memL));
 
-	int ifLocked;
-	ifLocked = 0;
+	int second;
+	second = getLock(getRZAddrHash(memR));
 
-	if(bucket >= 0 && bucket < HASHSZ){
-		lock = getLock(bucket);
-		if(lock == -1){
-			printf("ERROR: MUTEX DOES NOT EXIST.\n");
-			return 1;
-		}
+	if(first > second){
+		int tmp;
+		tmp = first;
+		first = second;
+		second = tmp;
+	}
 
-		ifLocked = pthread_mutex_unlock(&mutexes[lock]);
-		if(ifLocked == EINVAL || ifLocked == EPERM){
-			printf("ERROR: MUTEX TO BE UNLOCKED WAS NOT IN POSSESSION OF THREAD ATTEMPTING TO UNLOCK.\n");
-			return 1;
-		}
+	if(lockStripe(first) == 1){
+		return 1;
+	}
 
-		return 0;
+	if(second != first && lockStripe(second) == 1){
+		unlockStripe(first);
+		return 1;
 	}
 
-	return 1;
+	return 0;
 }
 
-int lock(void *mem){
-	if(mem == NULL){
-		printf("ERROR: ADDRESS GIVEN TO FUNCTION 'lock' WAS NOT VALID.\n");
+int unlockPair(void *memL, void *memR){
+	int first;
+	first = getLock(getRZAddrHash(memL));
+
+	int second;
+	second = getLock(getRZAddrHash(memR));
+
+	if(second != first && unlockStripe(second) == 1){
 		return 1;
 	}
 
-	int bucket;
-	bucket = getRZAddrBucket(mem);
+	return unlockStripe(first);
+}
 
-	int lock;
-	lock = -1;
+void lockAll(){
+	for(int i = 0; i < AMOUNT_OF_LOCKS; i++){
+		lockStripe(i);
+	}
+}
 
-	int ifLocked;
-	ifLocked = -1;
+void unlockAll(){
+	for(int i = AMOUNT_OF_LOCKS - 1; i >= 0; i--){
+		unlockStripe(i);
+	}
+}
 
-	if(bucket >= 0 && bucket < HASHSZ){
-		lock = getLock(bucket);
-		if(lock == -1){
-			printf("ERROR: LOCK DOES NOT EXIST.\n");
-			return 1;
+unsigned long int hashPage(unsigned long int page, int function){
+	if(function == HASH_FIBONACCI){
+		/* Multiplicative hashing. The buckets are selected by the lower bits of the hash, which only depend on the lower
+		   bits of the page number, so the upper half of the product (depending on all of them) is folded into them. This
+		   keeps objects placed at regular strides from piling up in the same buckets. */
+		unsigned long int product;
+		product = page * 11400714819323198485UL;
+
+		return (product ^ (product >> 32));
+	}else if(function == HASH_CRC32C){
+#if defined(__SSE4_2__)
+		return __builtin_ia32_crc32di(0xFFFFFFFF, page);
+#else
+		/* Bitwise equivalent of the instruction, for builds without SSE4.2. */
+		unsigned long int crc;
+		crc = 0xFFFFFFFF;
+
+		for(int i = 0; i < 64; i++){
+			crc = crc ^ ((page >> i) & 1);
+			crc = (crc >> 1) ^ (0x82F63B78 & (0 - (crc & 1)));
 		}
 
-		do{
-			 ifLocked = pthread_mutex_trylock(&mutexes[lock]);
+		return crc;
+#endif
+	}
+
+	return ((page) ^ ((page) >> 8) ^ ((page) >> 16) ^ ((page) >> 24));
+}
+
+unsigned long int getRZAddrHash(void *mem){
+	return hashPage(((unsigned long int) mem >> exponent), hashFunction);
+}
 
-			 if(ifLocked == EINVAL){
-			 	return 1;
-			 }else if(ifLocked == EBUSY){
-			 	busyCounter++;
-			 }
-		}while(ifLocked == EBUSY);
+rzHashBucket *getRZAddrBucket(void *mem){
+	unsigned long int hash;
+	hash = getRZAddrHash(mem);
 
-		/* Locked successfully. */
-		return 0;
+	rzTableState *state;
+	state = __atomic_load_n(&tableState, __ATOMIC_ACQUIRE);
+
+	if(state->oldBuckets != NULL){
+		/* During a rehash, buckets of the old table below the rehash index have already been moved to the new table. */
+		unsigned long int oldBucket;
+		oldBucket = hash & (state->oldSize - 1);
+
+		if(oldBucket >= __atomic_load_n(&state->rehashIndex, __ATOMIC_ACQUIRE)){
+			return &state->oldBuckets[oldBucket];
+		}
 	}
 
-	printf("ERROR: UNABLE TO LOCK MUTEX.\n");
-	return 1;
+	return &state->buckets[hash & (state->size - 1)];
+}
+
+unsigned long int getPage(void *mem){
+	return ((unsigned long int) mem >> exponent);
 }
 
-int getRZAddrBucket(void *mem){
-	/* Get most significant n bits from the address. */
-	unsigned long int pageNum;
-	pageNum = ((unsigned long int) mem >> exponent);
+void *getEntryAddrL(unsigned long int page, unsigned long int entry){
+	unsigned long int addr;
+	addr = (page << exponent) + (entry & ENTRY_OFFSET_MASK);
 
-	int bucket;
-	bucket = (((pageNum) ^ ((pageNum) >> 8) ^ ((pageNum) >> 16) ^ ((pageNum) >> 24)) & (HASHSZ -1));
+	/* An entry anchored on its right red-zone belongs to an object starting on an earlier page. */
+	if((entry & ENTRY_ANCHOR_R) != 0){
+		addr = addr - (entry >> ENTRY_SIZE_SHIFT);
+	}
 
-	return bucket;
+	return (void*) addr;
 }
 
-int checkRegistration(void *mem, int accessSize){
-	int rzBucket;
-	rzBucket = getRZAddrBucket(mem);
+void *getEntryAddrR(unsigned long int page, unsigned long int entry){
+	return getEntryAddrL(page, entry) + (entry >> ENTRY_SIZE_SHIFT);
+}
+
+unsigned long int packEntry(rzAddr *addr, unsigned long int page){
+	unsigned long int size;
+	size = (unsigned long int) (addr->startAddrR - addr->startAddrL);
+
+	if(getPage(addr->startAddrL) == page){
+		return (size << ENTRY_SIZE_SHIFT) | ((unsigned long int) addr->startAddrL - (page << exponent));
+	}
+
+	return (size << ENTRY_SIZE_SHIFT) | ENTRY_ANCHOR_R | ((unsigned long int) addr->startAddrR - (page << exponent));
+}
+
+unsigned long int getLineBit(void *mem){
+	return (1UL << (((unsigned long int) mem >> (exponent - 6)) & 63));
+}
+
+unsigned long int getRZLines(void *mem){
+	/* A red-zone crossing into the next page marks the first lines of the bitmap as well, which is where the address
+	   of the next page is tested. */
+	unsigned long int first;
+	first = (unsigned long int) mem >> (exponent - 6);
+
+	unsigned long int last;
+	last = ((unsigned long int) mem + rz_sz - 1) >> (exponent - 6);
+
+	if(last - first >= 63){
+		return ~0UL;
+	}
+
+	unsigned long int lines;
+	lines = 0;
+
+	for(unsigned long int i = first; i <= last; i++){
+		lines = lines | (1UL << (i & 63));
+	}
+
+	return lines;
+}
+
+unsigned long int getEntryLines(unsigned long int page, unsigned long int entry){
+	/* A lookup searches the runs of the pages on which a red-zone containing the address could start, so only those
+	   red-zones need to be marked. */
+	void *startAddrL;
+	startAddrL = getEntryAddrL(page, entry);
+
+	void *startAddrR;
+	startAddrR = getEntryAddrR(page, entry);
+
+	unsigned long int lines;
+	lines = 0;
+
+	if(getPage(startAddrL) == page){
+		lines = lines | getRZLines(startAddrL);
+	}
+
+	if(getPage(startAddrR) == page){
+		lines = lines | getRZLines(startAddrR);
+	}
+
+	return lines;
+}
+
+int findRunInList(unsigned long int page, rzEntries *entries, unsigned int counter, unsigned int *runCount){
+	/* A bucket holds the runs of only a few pages on average, so they are searched linearly. */
+	unsigned int index;
+	index = 0;
+
+	while(index < counter){
+		unsigned long int header;
+		header = __atomic_load_n(&entries->entries[index], __ATOMIC_RELAXED);
+
+		unsigned int count;
+		count = (unsigned int) (header & RUN_COUNT_MASK);
+
+		/* The header of the last run may already count entries appended after counter was read. */
+		if(index + 1 + count > counter){
+			count = counter - index - 1;
+		}
+
+		if((header >> RUN_COUNT_BITS) == page){
+			*runCount = count;
+			return (int) index;
+		}else if((header >> RUN_COUNT_BITS) > page){
+			return -1;
+		}
+
+		index = index + 1 + count;
+	}
+
+	return -1;
+}
+
+int findAddrInList(void *mem, unsigned long int page, rzEntries *entries){
+	/* Binary search for the last entry of the (sorted) run with a left red-zone starting at or before mem. Since
+	   registered objects never overlap, this is the only entry of the run whose red-zones can contain mem. */
+	if(entries == NULL){
+		return -1;
+	}
+
+	unsigned int counter;
+	counter = __atomic_load_n(&entries->counter, __ATOMIC_ACQUIRE);
+
+	unsigned int runCount;
+	runCount = 0;
+
+	int run;
+	run = findRunInList(page, entries, counter, &runCount);
+	if(run == -1){
+		return -1;
+	}
+
+	int low;
+	low = run + 1;
+
+	int high;
+	high = run + 1 + (int) runCount;
+
+	while(low < high){
+		int middle;
+		middle = (low + high) / 2;
+
+		if(getEntryAddrL(page, __atomic_load_n(&entries->entries[middle], __ATOMIC_RELAXED)) <= mem){
+			low = middle + 1;
+		}else{
+			high = middle;
+		}
+	}
+
+	if(low == run + 1){
+		return -1;
+	}
 
-	if(hashTable[rzBucket].counter == 0){
-		/* No red-zones registered, so addressable memory. */
+	return low - 1;
+}
+
+int checkAddrInRun(void *mem, unsigned long int page, rzAddr *hit){
+	/* Returns 1 if mem lies in a red-zone registered in the run of the given page, 0 otherwise. The caller must be in
+	   an epoch. */
+	rzEntries *entries;
+	entries = __atomic_load_n(&getRZAddrBucket((void*) (page << exponent))->entries, __ATOMIC_ACQUIRE);
+
+	/* If memory lies beyond the last red-zone of the array, it is nowhere in the array. Most addresses looked up are not
+	   in a red-zone at all (but merely hold the same value), so the line of the address is tested first. */
+	if(entries == NULL || mem >= (__atomic_load_n(&entries->end, __ATOMIC_RELAXED) + rz_sz) ||
+		(__atomic_load_n(&entries->lines, __ATOMIC_RELAXED) & getLineBit(mem)) == 0){
 		return 0;
 	}
 
-	/* If memory is not at all in the range between the first and last entries, it means the address
-	   is nowhere in the list (we can do this because the list is ordered). */
-	if(hashTable[rzBucket].first->startAddrL > mem){
-		/* The memory address given is smaller than the left-most red-zone. */
+	int index;
+	index = findAddrInList(mem, page, entries);
+	if(index == -1){
 		return 0;
-	}else if((hashTable[rzBucket].last->startAddrR + rz_sz) < mem){
-		/* The memory address given is greater than the right-most red-zone. */
+	}
+
+	unsigned long int entry;
+	entry = __atomic_load_n(&entries->entries[index], __ATOMIC_ACQUIRE);
+	if((entry & ENTRY_REMOVED) != 0){
 		return 0;
 	}
 
+	void *startAddrL;
+	startAddrL = getEntryAddrL(page, entry);
+
+	void *startAddrR;
+	startAddrR = getEntryAddrR(page, entry);
+
+	if(mem < startAddrR + rz_sz){
+		hit->startAddrL = startAddrL;
+		hit->startAddrR = startAddrR;
+	}
+
+	if((startAddrL <= mem && mem < startAddrL + rz_sz) || (startAddrR <= mem && mem < startAddrR + rz_sz)){
+		return 1;
+	}
+
+	return 0;
+}
+
+int checkHitCache(void *mem, unsigned long int *generation){
+	/* The removal generation is read before the table is searched, so an object removed during the search can not stay
+	   in the cache. */
+	*generation = __atomic_load_n(&removalGeneration, __ATOMIC_ACQUIRE);
+
+	if(*generation != hitGeneration){
+		hitGeneration = *generation;
+		hitCount = 0;
+		hitNext = 0;
+
+		return -1;
+	}
+
+	for(int i = 0; i < hitCount; i++){
+		rzAddr *current;
+		current = &hitCache[i];
+
+		if(current->startAddrL <= mem && mem < current->startAddrR + rz_sz){
+			if(mem < current->startAddrL + rz_sz || current->startAddrR <= mem){
+				return 1;
+			}
+
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+void addHitCache(rzAddr *hit, unsigned long int generation){
+	if(generation != hitGeneration){
+		return;
+	}
+
+	hitCache[hitNext] = *hit;
+	hitNext = (hitNext + 1) % HIT_CACHE_SIZE;
+
+	if(hitCount < HIT_CACHE_SIZE){
+		hitCount++;
+	}
+}
+
+int checkAddrInList(void *mem){
+	/* Returns 1 if mem lies in a registered red-zone, 0 otherwise. No lock is acquired: the epoch ensures that the
+	   arrays (and tables) read here are not freed until the check is done, even if they are replaced meanwhile. */
+	unsigned long int generation;
+	generation = 0;
+
+	int found;
+
+	if(useHitCache == 0){
+		found = checkHitCache(mem, &generation);
+		if(found != -1){
+			return found;
+		}
+	}
+
+	if(enterEpoch() == 1){
+		return -1;
+	}
+
+	rzAddr hit;
+	hit.startAddrL = NULL;
+	hit.startAddrR = NULL;
+
+	found = checkAddrInRun(mem, getPage(mem), &hit);
+
+	/* A red-zone containing mem may start on the previous page, in which case it is registered in the run of that page. */
+	if(found == 0 && getPage(mem - (rz_sz - 1)) != getPage(mem)){
+		found = checkAddrInRun(mem, getPage(mem - (rz_sz - 1)), &hit);
+	}
+
+	exitEpoch();
+
+	if(useHitCache == 0 && hit.startAddrL != NULL){
+		addHitCache(&hit, generation);
+	}
+
+	return found;
+}
+
+int checkRegistration(void *mem, int accessSize){
 	void *addedMem;
 	addedMem = 0;
 
@@ -243,14 +711,19 @@ int checkRegistration(void *mem, int accessSize){
 		addedMem = mem;
 	}
 
-	for(rzAddr *current = hashTable[rzBucket].first; current != (rzAddr*) NULL; current = current->next){
-		if((current->startAddrL <= mem && mem < current->startAddrL + rz_sz) || (current->startAddrR <= mem && mem < current->startAddrR + rz_sz) ||
-			(current->startAddrL <= addedMem && addedMem < current->startAddrL + rz_sz) || (current->startAddrR <= addedMem && addedMem < current->startAddrR + rz_sz)){
-			printf("ERROR: ATTEMPTING TO ACCESS UNADDRESSABLE (REDZONE) MEMORY.\n");
-			return 1;
-		}else{
-			continue;
-		}
+	int check;
+	check = checkAddrInList(mem);
+
+	/* The last byte of the access is looked up in its own bucket, since it may lie on the next page. */
+	if(check == 0 && addedMem != mem){
+		check = checkAddrInList(addedMem);
+	}
+
+	if(check == 1){
+		printf("ERROR: ATTEMPTING TO ACCESS UNADDRESSABLE (REDZONE) MEMORY.\n");
+		return 1;
+	}else if(check == -1){
+		return -1;
 	}
 
 	/* Memory address was not found in hash table, meaning it is addressable (or there is a very
@@ -355,482 +828,1243 @@ int checkMemoryAccess(void *mem, int accessSize){
 	return -1;
 }
 
-rzAddr *removeAddrFromList(rzAddr *toRemove, int rzBucket){
-	int found;
-	found = -1;
+int checkRangeRegistration(void *mem, size_t size){
+	/* A red-zone overlapping the range either contains one of its ends, or lies within it. Since it spans rz_sz bytes, it
+	   then contains one of the addresses at a stride of rz_sz from the start of the range. */
+	int check;
+	check = 0;
 
-	rzAddr *current;
-	current = NULL;
+	for(size_t offset = 0; offset < size; offset += rz_sz){
+		check = checkRegistration(mem + offset, 1);
+		if(check != 0){
+			return check;
+		}
+	}
 
-	rzAddr *prev;
-	prev = NULL;
+	return checkRegistration(mem + (size - 1), 1);
+}
 
-	if(hashTable[rzBucket].counter == 0){
-		printf("ERROR: NO REDZONES REGISTERED.\n");
-		return NULL;
-	}else{
-		for(current = hashTable[rzBucket].first; current != (rzAddr*) NULL; current = current->next){
-			if((current->startAddrL == toRemove->startAddrL) || (current->startAddrR == toRemove->startAddrR)){
-				found = 0;
+int checkMemoryRange(void *mem, size_t size){
+	/* Returns a negative integer if the address was invalid, 0 if no byte of the range lies in a red-zone, and a positive
+	   integer otherwise. */
+	if(init == 0){
+		if(initLib() == 1){
+			printf("ERROR: INITIALISATION OF LIBRARY FAILED.\n");
+			return -1;
+		}
+	}
 
-				if(current->next == NULL){
-					if(prev == NULL){
-						hashTable[rzBucket].first = NULL;
-						hashTable[rzBucket].last = NULL;
+	if(mem == NULL){
+		return -1;
+	}
 
-						break;
-					}else{
-						prev->next = NULL;
-						hashTable[rzBucket].last = prev;
+	if(size == 0){
+		return 0;
+	}
 
-						break;
-					}
-				}else if(prev == NULL){
-					hashTable[rzBucket].first = current->next;
+	if(useRegistration == 0 && fastCheckInit == 1){
+		/* Without the pattern, every red-zone that might overlap the range is looked up. */
+		return checkRangeRegistration(mem, size);
+	}
 
-					break;
-				}else{
-					prev->next = current->next;
+	unsigned char *current;
+	current = mem;
 
-					break;
-				}
-			}
+	unsigned char *end;
+	end = mem + size;
 
-			/* Save the current entry, for list arithmetic. */
-			prev = current;
+	while(current < end){
+		/* Only a run of the pattern can be (a part of) a red-zone. */
+		unsigned char *start;
+		start = memchr(current, redzone, end - current);
+
+		if(start == NULL){
+			return 0;
+		}
+
+		if(useRegistration == 1){
+			/* In this mode, the pattern is the only detection mechanism. */
+			return 1;
 		}
 
-		hashTable[rzBucket].counter--;
+		current = start;
+		while(current < end && *current == redzone){
+			current++;
+		}
+
+		int check;
+		check = checkRangeRegistration(start, current - start);
+		if(check != 0){
+			return check;
+		}
+	}
+
+	return 0;
+}
+
+void appendEntry(rzEntries *to, unsigned long int page, unsigned long int entry){
+	if(to->counter == 0 || (to->entries[to->lastRun] >> RUN_COUNT_BITS) != page){
+		to->lastRun = to->counter;
+		to->entries[to->counter] = page << RUN_COUNT_BITS;
+		to->counter++;
+		to->runs++;
+	}
+
+	to->entries[to->counter] = entry;
+	to->entries[to->lastRun]++;
+	to->counter++;
+
+	to->lines = to->lines | getEntryLines(page, entry);
+
+	void *startAddrR;
+	startAddrR = getEntryAddrR(page, entry);
+	if(to->end < startAddrR){
+		to->end = startAddrR;
+	}
+}
+
+rzEntries *copyEntries(rzEntries *from, rzAddr *toAdd, unsigned long int page){
+	/* Create a copy of the array without its removed entries, with room to append to. If toAdd is given, it is inserted
+	   in its (sorted) position. */
+	unsigned int words;
+	words = 0;
+
+	if(from != NULL){
+		words = from->counter - from->removed;
+	}
+
+	/* The entry, and possibly the header of a new run. */
+	if(toAdd != NULL){
+		words = words + 2;
+	}
+
+	unsigned int size;
+	size = BUCKET_INITIAL_SIZE;
+	while(size <= words){
+		size = size * 2;
+	}
+
+	rzEntries *to;
+	to = allocateEntries(size);
+	if(to == NULL){
+		return NULL;
+	}
+
+	unsigned long int added;
+	added = 0;
+
+	if(toAdd != NULL){
+		added = packEntry(toAdd, page);
+	}
+
+	unsigned int index;
+	index = 0;
+
+	while(from != NULL && index < from->counter){
+		unsigned long int runPage;
+		runPage = from->entries[index] >> RUN_COUNT_BITS;
+
+		unsigned int count;
+		count = (unsigned int) (from->entries[index] & RUN_COUNT_MASK);
+
+		for(unsigned int i = index + 1; i <= index + count; i++){
+			unsigned long int current;
+			current = from->entries[i];
+
+			if((current & ENTRY_REMOVED) != 0){
+				continue;
+			}
+
+			if(toAdd != NULL && (page < runPage || (page == runPage && toAdd->startAddrL < getEntryAddrL(runPage, current)))){
+				appendEntry(to, page, added);
+				toAdd = NULL;
+			}
+
+			appendEntry(to, runPage, current);
+		}
+
+		index = index + 1 + count;
+	}
+
+	if(toAdd != NULL){
+		appendEntry(to, page, added);
+	}
+
+	return to;
+}
+
+void publishEntries(rzHashBucket *bucket, rzEntries *entries){
+	/* Readers either see the old or the new array, and the old one is only freed once no reader can still see it. */
+	rzEntries *old;
+	old = bucket->entries;
+
+	__atomic_store_n(&bucket->entries, entries, __ATOMIC_RELEASE);
+
+	retireMemory(old, freeEntries);
+}
+
+int removeAddrFromList(rzAddr *toRemove, rzHashBucket *bucket, unsigned long int page){
+	/* Remove the entry with the given left red-zone address from the run of the page, and return the right red-zone
+	   address recorded for it in toRemove. */
+	rzEntries *entries;
+	entries = bucket->entries;
+
+	if(entries == NULL){
+		printf("ERROR: NO REDZONES REGISTERED.\n");
+		return 1;
+	}
+
+	int index;
+	index = findAddrInList(toRemove->startAddrL, page, entries);
+
+	if(index == -1 || (entries->entries[index] & ENTRY_REMOVED) != 0 || getEntryAddrL(page, entries->entries[index]) != toRemove->startAddrL){
+		printf("ERROR: NO REDZONE FOUND FOR REMOVAL.\n");
+		return 1;
+	}
+
+	toRemove->startAddrR = getEntryAddrR(page, entries->entries[index]);
+
+	/* The entry is marked as removed in place, since readers might be searching the array. */
+	__atomic_store_n(&entries->entries[index], entries->entries[index] | ENTRY_REMOVED, __ATOMIC_RELEASE);
+	entries->removed++;
+
+	if(entries->removed + entries->runs == entries->counter){
+		publishEntries(bucket, NULL);
+	}else if(entries->counter >= BUCKET_INITIAL_SIZE && entries->removed * 2 > entries->counter - entries->runs){
+		/* Compact the array once most of it consists of removed entries. */
+		rzEntries *compacted;
+		compacted = copyEntries(entries, NULL, 0);
+		if(compacted != NULL){
+			publishEntries(bucket, compacted);
+		}
+	}
+
+	return 0;
+}
+
+int removeAddr(void *memL, void *memR){
+	rzHashBucket *lrzBucket;
+	lrzBucket = NULL;
+
+	rzHashBucket *rrzBucket;
+	rrzBucket = NULL;
+
+	int firstAddrLock;
+	firstAddrLock = 0;
+
+	int secondAddrLock;
+	secondAddrLock = 0;
+
+	if(memL == NULL){
+		/* We always require the left red-zone address to perform a remove. The address of the right red-zone is
+		   optional, since it is recorded in the entry of the left red-zone. */
+		printf("ERROR: INVALID STARTING ADDRESS PROVIDED.\n");
+		return 1;
+	}
+
+	/* Used to find the entry. The right red-zone address is unknown on a deallocation (it cannot be extracted from the
+	   pointer given to free()), so it is recovered from the entry. */
+	rzAddr toRemove;
+	toRemove.startAddrL = memL;
+	toRemove.startAddrR = memR;
+
+	if(lock(memL) == 1){
+		return 1;
+	}
+
+	/* The bucket can only be looked up while holding its lock, since a rehash might be moving it. */
+	lrzBucket = getRZAddrBucket(memL);
+
+	if(removeAddrFromList(&toRemove, lrzBucket, getPage(memL)) == 1){
+		unlock(memL);
+		return 1;
+	}
+
+	if(getPage(toRemove.startAddrR) == getPage(memL)){
+		/* Both red-zones start on the same page, so the object has a single entry. */
+		if(unlock(memL) == 1){
+			return 1;
+		}
+
+		/* Invalidate the objects cached by all threads, once the entry can no longer be found. */
+		__atomic_add_fetch(&removalGeneration, 1, __ATOMIC_RELEASE);
+		__atomic_sub_fetch(&registeredAddrs, 1, __ATOMIC_RELAXED);
+		rehashStep();
+
+		return 0;
+	}
+
+	firstAddrLock = getLock(getRZAddrHash(memL));
+	secondAddrLock = getLock(getRZAddrHash(toRemove.startAddrR));
+
+	if(firstAddrLock != secondAddrLock){
+		/* Different locks imply different buckets, meaning a cross-page allocation was performed. Then, the entry must
+		   be removed from that specific bucket as well. The lock of the right red-zone is only known now, so the first
+		   lock is released before acquiring it (holding both could violate the lock order of lockPair). */
+		if(unlock(memL) == 1){
+			return 1;
+		}
+
+		if(lock(toRemove.startAddrR) == 1){
+			return 1;
+		}
+
+		rrzBucket = getRZAddrBucket(toRemove.startAddrR);
+
+		if(removeAddrFromList(&toRemove, rrzBucket, getPage(toRemove.startAddrR)) == 1){
+			unlock(toRemove.startAddrR);
+			return 1;
+		}
+
+		if(unlock(toRemove.startAddrR) == 1){
+			return 1;
+		}
+	}else{
+		/* The run of the right red-zone may be in the same bucket. */
+		rrzBucket = getRZAddrBucket(toRemove.startAddrR);
+
+		if(removeAddrFromList(&toRemove, rrzBucket, getPage(toRemove.startAddrR)) == 1){
+			unlock(memL);
+			return 1;
+		}
+
+		if(unlock(memL) == 1){
+			return 1;
+		}
+	}
+
+	__atomic_add_fetch(&removalGeneration, 1, __ATOMIC_RELEASE);
+	__atomic_sub_fetch(&registeredAddrs, 1, __ATOMIC_RELAXED);
+	rehashStep();
+
+	return 0;
+}
+
+int addAddrToList(rzAddr *toAdd, rzHashBucket *bucket, unsigned long int page){
+	rzEntries *entries;
+	entries = bucket->entries;
+
+	unsigned long int entry;
+	entry = packEntry(toAdd, page);
+
+	if(entries != NULL && entries->end < toAdd->startAddrL){
+		/* It was observed that addresses are often allocated increasingly, in which case the entry is simply appended,
+		   to the last run if it is of the same page, or in a new one. The words are written before the counter is
+		   increased, so readers never see them incomplete. */
+		unsigned long int lastPage;
+		lastPage = entries->entries[entries->lastRun] >> RUN_COUNT_BITS;
+
+		if(lastPage == page && entries->counter < entries->size){
+			entries->entries[entries->counter] = entry;
+			__atomic_store_n(&entries->entries[entries->lastRun], entries->entries[entries->lastRun] + 1, __ATOMIC_RELAXED);
+			__atomic_store_n(&entries->lines, entries->lines | getEntryLines(page, entry), __ATOMIC_RELAXED);
+			__atomic_store_n(&entries->end, toAdd->startAddrR, __ATOMIC_RELAXED);
+			__atomic_store_n(&entries->counter, entries->counter + 1, __ATOMIC_RELEASE);
+
+			return 0;
+		}else if(lastPage < page && entries->counter + 1 < entries->size){
+			entries->entries[entries->counter] = (page << RUN_COUNT_BITS) | 1;
+			entries->entries[entries->counter + 1] = entry;
+			entries->lastRun = entries->counter;
+			entries->runs++;
+			__atomic_store_n(&entries->lines, entries->lines | getEntryLines(page, entry), __ATOMIC_RELAXED);
+			__atomic_store_n(&entries->end, toAdd->startAddrR, __ATOMIC_RELAXED);
+			__atomic_store_n(&entries->counter, entries->counter + 2, __ATOMIC_RELEASE);
+
+			return 0;
+		}
+	}
+
+	int index;
+	index = findAddrInList(toAdd->startAddrL, page, entries);
+
+	/* Compare the red-zone entry with its (registered) neighbours in the run. */
+	if(index != -1 && (entries->entries[index] & ENTRY_REMOVED) == 0 && (getEntryAddrL(page, entries->entries[index]) == toAdd->startAddrL ||
+		getEntryAddrR(page, entries->entries[index]) == toAdd->startAddrR)){
+		/* Red-zone (or part of it) already in the table. */
+		printf("ERROR: REDZONE ALREADY REGISTERED.\n");
+		return 1;
+	}
+
+	unsigned int runCount;
+	runCount = 0;
+
+	int run;
+	run = -1;
+
+	if(entries != NULL){
+		run = findRunInList(page, entries, entries->counter, &runCount);
+	}
+
+	int next;
+	next = index + 1;
+	if(index == -1){
+		next = run + 1;
+	}
+
+	if(run != -1 && next <= run + (int) runCount && (entries->entries[next] & ENTRY_REMOVED) == 0 &&
+		getEntryAddrR(page, entries->entries[next]) == toAdd->startAddrR){
+		printf("ERROR: REDZONE ALREADY REGISTERED.\n");
+		return 1;
+	}
+
+	/* Otherwise, publish a new array with the entry inserted in its position. */
+	rzEntries *inserted;
+	inserted = copyEntries(entries, toAdd, page);
+	if(inserted == NULL){
+		return 1;
+	}
+
+	publishEntries(bucket, inserted);
+
+	return 0;
+}
+
+int registerAddr(void *memL, void *memR){
+	rzHashBucket *lrzBucket;
+	lrzBucket = NULL;
+
+	rzHashBucket *rrzBucket;
+	rrzBucket = NULL;
+
+	if(memL == NULL || memR == NULL){
+		/* Requires two valid red-zone addresses for a register. */
+		return 1;
+	}
+
+	/* The entry is packed into the run of the page of both red-zones. */
+	rzAddr toAdd;
+	toAdd.startAddrL = memL;
+	toAdd.startAddrR = memR;
+
+	/* For a cross-page allocation, the entry must be saved in different runs at the same time. Both locks are held,
+	   so the entry becomes visible in both at once. */
+	if(lockPair(memL, memR) == 1){
+		return 1;
+	}
+
+	/* The buckets can only be looked up while holding their locks, since a rehash might be moving them. */
+	lrzBucket = getRZAddrBucket(memL);
+	rrzBucket = getRZAddrBucket(memR);
+
+	if(addAddrToList(&toAdd, lrzBucket, getPage(memL)) == 1){
+		unlockPair(memL, memR);
+		return 1;
+	}
+
+	if(getPage(memR) != getPage(memL) && addAddrToList(&toAdd, rrzBucket, getPage(memR)) == 1){
+		/* Undo the registration in the run of the left red-zone. */
+		removeAddrFromList(&toAdd, lrzBucket, getPage(memL));
+		unlockPair(memL, memR);
+
+		return 1;
+	}
+
+	if(unlockPair(memL, memR) == 1){
+		return 1;
+	}
+
+	__atomic_add_fetch(&registeredAddrs, 1, __ATOMIC_RELAXED);
+	rehashStep();
+
+	return 0;
+}
+
+int insertRZPattern(void *mem, size_t size){
+	if(init == 0){
+		if(initLib() == 1){
+			printf("ERROR: INITIALISATION OF LIBRARY FAILED.\n");
+			return 1;
+		}
+	}
+
+	/* Use a custom size for global, stack, or static objects (specified, customisable). If the size
+	   is either 0 (standard whenever not using a custom size) or not a multiple of 8, also use
+	   the standard size (red-zone size, defined by scale). */
+	int amount;
+	if(size == 0 || size % 8 != 0){
+		amount = rz_sz;
+	}else{
+		amount = size;
+	}
+
+	if(memset(mem, redzone, amount) == NULL){
+		return 1;
+	}
+
+	return 0;
+}
+
+/*----------------Rehash Functions----------------*/
+int rehashBucket(rzTableState *state, unsigned long int oldBucket){
+	/* Move the runs of a bucket of the old table to the new table. Every run belongs to a single page, and is only stored
+	   in the bucket of that page, so its entries are simply added to the run of the page in the new table. */
+	rzEntries *entries;
+	entries = state->oldBuckets[oldBucket].entries;
+
+	int check;
+	check = 0;
+
+	unsigned int index;
+	index = 0;
+
+	while(entries != NULL && index < entries->counter){
+		unsigned long int page;
+		page = entries->entries[index] >> RUN_COUNT_BITS;
+
+		unsigned int count;
+		count = (unsigned int) (entries->entries[index] & RUN_COUNT_MASK);
+
+		rzHashBucket *newBucket;
+		newBucket = &state->buckets[getRZAddrHash((void*) (page << exponent)) & (state->size - 1)];
+
+		for(unsigned int i = index + 1; i <= index + count; i++){
+			if((entries->entries[i] & ENTRY_REMOVED) != 0){
+				continue;
+			}
+
+			rzAddr current;
+			current.startAddrL = getEntryAddrL(page, entries->entries[i]);
+			current.startAddrR = getEntryAddrR(page, entries->entries[i]);
+
+			if(addAddrToList(&current, newBucket, page) == 1){
+				printf("ERROR: FAILED TO MOVE REDZONE DURING REHASH.\n");
+				check = 1;
+			}
+		}
+
+		index = index + 1 + count;
+	}
+
+	return check;
+}
+
+int beginRehash(rzTableState *state, unsigned long int newSize){
+	/* Allocate the new table and state before acquiring the locks, and then swap the states. Only the (empty) buckets are
+	   allocated, the entries are moved incrementally by rehashStep. */
+	rzTableState *newState;
+	newState = (rzTableState*) malloc(sizeof(struct rzTableState));
+	if(newState == NULL){
+		return 1;
+	}
+
+	newState->buckets = (rzHashBucket*) calloc(newSize, sizeof(struct rzHashBucket));
+	if(newState->buckets == NULL){
+		free(newState);
+		return 1;
+	}
+
+	newState->size = newSize;
+	newState->oldBuckets = state->buckets;
+	newState->oldSize = state->size;
+	newState->rehashIndex = 0;
+
+	/* Writers look up their bucket while holding its lock, so holding all locks ensures none of them still uses the
+	   previous state. Readers might, which is why it is retired instead of freed. */
+	lockAll();
+	__atomic_store_n(&tableState, newState, __ATOMIC_RELEASE);
+	unlockAll();
+
+	if(state != &initialTableState){
+		retireMemory(state, free);
+	}
+
+	return 0;
+}
+
+int finishRehash(rzTableState *state){
+	rzTableState *newState;
+	newState = (rzTableState*) malloc(sizeof(struct rzTableState));
+	if(newState == NULL){
+		return 1;
+	}
+
+	newState->buckets = state->buckets;
+	newState->size = state->size;
+	newState->oldBuckets = NULL;
+	newState->oldSize = 0;
+	newState->rehashIndex = 0;
+
+	lockAll();
+	__atomic_store_n(&tableState, newState, __ATOMIC_RELEASE);
+	unlockAll();
+
+	/* The initial table is statically allocated. */
+	if(state->oldBuckets != initialHashTable){
+		retireMemory(state->oldBuckets, free);
+	}
+
+	if(state != &initialTableState){
+		retireMemory(state, free);
+	}
+
+	return 0;
+}
+
+void rehashStep(){
+	if(useRehash != 0){
+		return;
+	}
+
+	/* Only one thread rehashes at a time. If another one is busy, it will do the work. */
+	if(pthread_mutex_trylock(&rehashMutex) != 0){
+		return;
+	}
+
+	/* Only the thread holding the rehash mutex replaces the state. */
+	rzTableState *state;
+	state = tableState;
+
+	if(state->oldBuckets == NULL){
+		unsigned long int entries;
+		entries = __atomic_load_n(&registeredAddrs, __ATOMIC_RELAXED);
+
+		if(entries > state->size * HASH_MAX_LOAD){
+			beginRehash(state, state->size * 2);
+		}else if(state->size > HASHSZ && entries < state->size * HASH_MIN_LOAD){
+			beginRehash(state, state->size / 2);
+		}
+	}else{
+		/* Move a few buckets per operation, so no single allocation or deallocation pays for the entire rehash. */
+		for(int i = 0; i < REHASH_STEP && state->rehashIndex < state->oldSize; i++){
+			unsigned long int oldBucket;
+			oldBucket = state->rehashIndex;
+
+			int stripe;
+			stripe = getLock(oldBucket);
+
+			lockStripe(stripe);
+
+			rehashBucket(state, oldBucket);
+			__atomic_store_n(&state->rehashIndex, oldBucket + 1, __ATOMIC_RELEASE);
+
+			/* The array of the old bucket is unreachable for readers arriving from now on. */
+			retireMemory(state->oldBuckets[oldBucket].entries, freeEntries);
+
+			unlockStripe(stripe);
+		}
+
+		if(state->rehashIndex == state->oldSize){
+			finishRehash(state);
+		}
+	}
+
+	pthread_mutex_unlock(&rehashMutex);
+}
+/*--------------------------------*/
+
+/*----------------Epoch Functions----------------*/
+void createEpochKey(){
+	pthread_key_create(&epochKey, destroyEpochRecord);
+}
+
+void prepareFork(){
+	/* A fork might happen while another thread holds a lock of the table, the rehash mutex or the mutex of the entry pool,
+	   which would then stay locked forever in the child. They are taken in the order used by rehashStep() and the
+	   registrations (which allocate entries while holding a stripe). */
+	pthread_mutex_lock(&rehashMutex);
+	lockAll();
+	lockEntryPool();
+}
+
+void parentFork(){
+	unlockEntryPool();
+	unlockAll();
+	pthread_mutex_unlock(&rehashMutex);
+}
+
+void childFork(){
+	unlockEntryPool();
+	unlockAll();
+	pthread_mutex_unlock(&rehashMutex);
+
+	/* Only the forking thread exists in the child. The records of the other threads would keep the state they had at the
+	   fork forever, and a reading one would stop the epoch from advancing, so they are released. */
+	for(epochRecord *current = __atomic_load_n(&epochRecords, __ATOMIC_ACQUIRE); current != NULL; current = current->next){
+		if(current != threadRecord){
+			__atomic_store_n(&current->state, 0, __ATOMIC_RELAXED);
+			__atomic_store_n(&current->inUse, 0, __ATOMIC_RELAXED);
+		}
+	}
+}
+
+void destroyEpochRecord(void *record){
+	/* Called on thread exit. Apply the logged removals of the thread, free the memory retired by it (waiting for the
+	   readers if necessary), return its cached arrays of entries, and make its record available to new threads. */
+	flushRemovalLog();
+
+	while(retiredCount > 0){
+		reclaimMemory();
+
+		if(retiredCount > 0){
+			sched_yield();
+		}
+	}
+
+	/* Return the cached arrays of entries (including those just freed) to the pool. */
+	for(int i = 0; i < ENTRY_CLASSES; i++){
+		flushEntryCache(i, 1);
+	}
+
+	__atomic_store_n(&((epochRecord*) record)->state, 0, __ATOMIC_RELEASE);
+	__atomic_store_n(&((epochRecord*) record)->inUse, 0, __ATOMIC_RELEASE);
+
+	threadRecord = NULL;
+}
+
+epochRecord *getEpochRecord(){
+	if(threadRecord != NULL){
+		return threadRecord;
+	}
+
+	pthread_once(&epochKeyOnce, createEpochKey);
+
+	epochRecord *record;
+	record = NULL;
+
+	/* Reuse the record of an exited thread, if there is one. */
+	for(epochRecord *current = __atomic_load_n(&epochRecords, __ATOMIC_ACQUIRE); current != NULL; current = current->next){
+		int expected;
+		expected = 0;
+
+		if(__atomic_compare_exchange_n(&current->inUse, &expected, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)){
+			record = current;
+			break;
+		}
+	}
+
+	if(record == NULL){
+		if(posix_memalign((void**) &record, sizeof(epochRecord), sizeof(epochRecord)) != 0){
+			printf("ERROR: FAILED TO ALLOCATE EPOCH RECORD.\n");
+			return NULL;
+		}
+
+		record->state = 0;
+		record->inUse = 1;
+
+		/* Records are never removed from the list, so a push is all that is needed. */
+		record->next = __atomic_load_n(&epochRecords, __ATOMIC_RELAXED);
+		while(!__atomic_compare_exchange_n(&epochRecords, &record->next, record, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+	}
+
+	threadRecord = record;
+	pthread_setspecific(epochKey, record);
+
+	return record;
+}
+
+int enterEpoch(){
+	epochRecord *record;
+	record = getEpochRecord();
+	if(record == NULL){
+		return 1;
+	}
+
+	/* Announce the epoch this thread reads in, before reading anything from the table. */
+	__atomic_store_n(&record->state, (__atomic_load_n(&globalEpoch, __ATOMIC_SEQ_CST) << 1) | 1, __ATOMIC_SEQ_CST);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+	return 0;
+}
+
+void exitEpoch(){
+	__atomic_store_n(&threadRecord->state, 0, __ATOMIC_RELEASE);
+}
+
+unsigned long int tryAdvanceEpoch(){
+	/* The epoch can only advance once every thread that is reading has observed the current epoch. */
+	unsigned long int epoch;
+	epoch = __atomic_load_n(&globalEpoch, __ATOMIC_SEQ_CST);
+
+	for(epochRecord *current = __atomic_load_n(&epochRecords, __ATOMIC_ACQUIRE); current != NULL; current = current->next){
+		unsigned long int state;
+		state = __atomic_load_n(&current->state, __ATOMIC_SEQ_CST);
+
+		if((state & 1) == 1 && (state >> 1) != epoch){
+			return epoch;
+		}
+	}
+
+	if(__atomic_compare_exchange_n(&globalEpoch, &epoch, epoch + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)){
+		return epoch + 1;
+	}
+
+	/* Another thread advanced the epoch. */
+	return epoch;
+}
+
+void reclaimMemory(){
+	unsigned long int epoch;
+	epoch = tryAdvanceEpoch();
+
+	int kept;
+	kept = 0;
+
+	/* Memory retired in epoch N can no longer be referenced by any reader once the epoch reaches N + 2. */
+	for(int i = 0; i < retiredCount; i++){
+		if(retired[i].epoch + 2 <= epoch){
+			retired[i].destroy(retired[i].mem);
+		}else{
+			retired[kept] = retired[i];
+			kept++;
+		}
+	}
+
+	retiredCount = kept;
+}
+
+void retireMemory(void *mem, void (*destroy)(void *mem)){
+	if(mem == NULL){
+		return;
+	}
+
+	/* Ensures the retired memory of this thread is freed on its exit. */
+	getEpochRecord();
+
+	while(retiredCount == RETIRE_LIMIT){
+		reclaimMemory();
+
+		if(retiredCount == RETIRE_LIMIT){
+			sched_yield();
+		}
+	}
+
+	retired[retiredCount].mem = mem;
+	retired[retiredCount].destroy = destroy;
+	retired[retiredCount].epoch = __atomic_load_n(&globalEpoch, __ATOMIC_SEQ_CST);
+	retiredCount++;
+
+	if(retiredCount >= RETIRE_LIMIT / 2){
+		reclaimMemory();
+	}
+}
+/*--------------------------------*/
+
+/*----------------Entry Pool Functions----------------*/
+int getEntryClass(unsigned int size){
+	/* Arrays of entries always hold a power of two (and at least BUCKET_INITIAL_SIZE) words. */
+	int entryClass;
+	entryClass = 0;
+
+	while(entryClass < ENTRY_CLASSES && (unsigned int) (BUCKET_INITIAL_SIZE << entryClass) < size){
+		entryClass++;
+	}
+
+	if(entryClass == ENTRY_CLASSES || (unsigned int) (BUCKET_INITIAL_SIZE << entryClass) != size){
+		return -1;
 	}
 
-	
-	if(found != 0){
-		printf("ERROR: NO REDZONE FOUND FOR REMOVAL.\n");
-		return NULL;
-	}else{
-		return current;
-	}
+	return entryClass;
 }
 
-int removeAddr(void *memL, void *memR){
-	rzAddr *current;
-	current = NULL;
+size_t getEntryClassSize(int entryClass){
+	return sizeof(struct rzEntries) + (BUCKET_INITIAL_SIZE << entryClass) * sizeof(unsigned long int);
+}
 
-	rzAddr *crossCurrent;
-	crossCurrent = NULL;
+int refillEntryCache(int entryClass){
+	/* Ensures the cache of this thread is returned to the pool on its exit. */
+	if(getEpochRecord() == NULL){
+		return 1;
+	}
 
-	int lrzBucket;
-	lrzBucket = -1;
+	entryCache *cache;
+	cache = &entryCaches[entryClass];
 
-	int rrzBucket;
-	rrzBucket = -1;
+	/* Take a batch returned by another thread, if there is one. */
+	pthread_mutex_lock(&entryPoolMutex);
 
-	int addrLock;
-	addrLock = -1;
+	freeEntry *batch;
+	batch = entryPool[entryClass];
+	if(batch != NULL){
+		entryPool[entryClass] = batch->nextBatch;
+	}
 
-	int standardCrossAlloc;
-	standardCrossAlloc = -1;
+	pthread_mutex_unlock(&entryPoolMutex);
 
-	int memRUnknown;
-	memRUnknown = -1;
+	if(batch != NULL){
+		cache->first = batch;
+		cache->counter = batch->counter;
 
-	int firstAddrLock;
-	firstAddrLock = 0;
+		return 0;
+	}
 
-	int secondAddrLock;
-	secondAddrLock = 0;
+	/* Otherwise, carve a new slab into arrays. Slabs are never returned to the system. */
+	size_t objectSize;
+	objectSize = getEntryClassSize(entryClass);
 
-	if(memL == NULL){
-		/* We always require the left red-zone address to perform a remove. The address of the right red-zone is
-		   optional. */
-		printf("ERROR: INVALID STARTING ADDRESS PROVIDED.\n");
-		return 1;
-	}else if(memR == NULL){
-		/* This means that the right red-zone address is unknown on deallocation. This is possible for any free
-		   since we cannot extract the right red-zone address directly from the pointer given to free(). */
-		lrzBucket = getRZAddrBucket(memL);
-		memRUnknown= 0;
-	}else{
-		lrzBucket = getRZAddrBucket(memL);
-		rrzBucket = getRZAddrBucket(memR);
-		if(lrzBucket != rrzBucket){
-			/* A cross-page allocation occurred, meaning that we require this entry to be saved in different buckets
-			   at the same time. */
-			standardCrossAlloc = 0;
-		}
+	size_t amount;
+	amount = ENTRY_SLAB_SIZE / objectSize;
+	if(amount < ENTRY_BATCH){
+		amount = ENTRY_BATCH;
 	}
-	
-	/* The very first bucket is 0, the very last bucket is 255. */
-	if(!(lrzBucket >= 0 && lrzBucket < HASHSZ)){
+
+	char *slab;
+	slab = (char*) malloc(amount * objectSize);
+	if(slab == NULL){
 		return 1;
 	}
 
-	if(memRUnknown != 0){
-		if(!(rrzBucket >= 0 && rrzBucket < HASHSZ)){
-			return 1;
-		}
+	for(size_t i = amount; i > 0; i--){
+		freeEntry *current;
+		current = (freeEntry*) (slab + (i - 1) * objectSize);
+
+		current->next = cache->first;
+		cache->first = current;
 	}
 
-	/* Used to find list entry, and to remove and deallocate it from the list and memory. */
-	rzAddr toRemove;
-	toRemove.startAddrL = memL;
-	toRemove.startAddrR = memR;
+	cache->counter = cache->counter + amount;
 
-	if(lock(memL) == 1){
-		return 1;
-	}
+	return 0;
+}
 
-	if(memRUnknown == 0){
-		current = removeAddrFromList(&toRemove, lrzBucket);
-		if(current == NULL){
-			unlock(memL);
-			return 1;
+void flushEntryCache(int entryClass, int all){
+	/* Return a batch of arrays (or all of them, on thread exit) from the cache of this thread to the global pool. */
+	entryCache *cache;
+	cache = &entryCaches[entryClass];
+
+	while(cache->counter != 0){
+		unsigned int amount;
+		amount = cache->counter;
+		if(amount > ENTRY_BATCH){
+			amount = ENTRY_BATCH;
 		}
 
-		/* Recover the right red-zone address from the left red-zone entry (from the known bucket), and
-		   use it to now find the other entry in the different bucket (if a cross-page allocation occurred). */
-		if(current->startAddrR == NULL){
-			/* The memory was recorded as only having a left red-zone. Therefore, we perform no additional steps.
-			   This, technically, is possible, but should not happen. We error, but do not exit, since it
-			   is not a fatal error. */
-			unlock(memL);
+		freeEntry *batch;
+		batch = cache->first;
 
-			printf("ERROR: NO RIGHT RED-ZONE RECORDED.\n");
-			free(current);
-			return 1;
-		}else{
-			toRemove.startAddrR = current->startAddrR;
+		freeEntry *last;
+		last = batch;
+
+		for(unsigned int i = 1; i < amount; i++){
+			last = last->next;
 		}
-		
-		rrzBucket = getRZAddrBucket(toRemove.startAddrR);
 
-		if(!(rrzBucket >= 0 && rrzBucket < HASHSZ)){
-			free(current);
+		cache->first = last->next;
+		cache->counter = cache->counter - amount;
 
-			unlock(memL);
-			return 1;
-		}
+		last->next = NULL;
+		batch->counter = amount;
 
-		/* If the buckets are different, this means a cross-page allocation was performed. Then, the
-		   entry must be removed from that specific bucket as well. If they are equal, the entry can simply be deallocated,
-		   meaning that the removal was successful. */
-		if(rrzBucket != lrzBucket){
-			firstAddrLock = getLock(lrzBucket);
-			secondAddrLock = getLock(rrzBucket);
+		pthread_mutex_lock(&entryPoolMutex);
+		batch->nextBatch = entryPool[entryClass];
+		entryPool[entryClass] = batch;
+		pthread_mutex_unlock(&entryPoolMutex);
 
-			if(firstAddrLock != secondAddrLock){
-				unlock(memL);
+		if(all == 0){
+			break;
+		}
+	}
+}
 
-				if(lock(toRemove.startAddrR) == 1){
-					free(current);
-					return 1;
-				}
-			}
+rzEntries *allocateEntries(unsigned int size){
+	rzEntries *entries;
+	entries = NULL;
 
-			crossCurrent = removeAddrFromList(&toRemove, rrzBucket);
-			if(crossCurrent == NULL){
-				free(current);
+	int entryClass;
+	entryClass = getEntryClass(size);
 
-				if(firstAddrLock != secondAddrLock){
-					unlock(toRemove.startAddrR);
-				}else{
-					unlock(memL);
-				}
+	if(entryClass == -1){
+		/* Larger than any size class. */
+		entries = (rzEntries*) malloc(sizeof(struct rzEntries) + size * sizeof(unsigned long int));
+	}else{
+		entryCache *cache;
+		cache = &entryCaches[entryClass];
 
-				return 1;
-			}
+		if(cache->first == NULL && refillEntryCache(entryClass) == 1){
+			return NULL;
+		}
 
-			if(firstAddrLock != secondAddrLock){
-				if(unlock(toRemove.startAddrR) == 1){
-					free(current);
-					free(crossCurrent);
+		entries = (rzEntries*) cache->first;
+		cache->first = cache->first->next;
+		cache->counter--;
+	}
 
-					return 1;
-				}
-			}else{
-				unlock(memL);
-			}
+	if(entries == NULL){
+		return NULL;
+	}
 
-			/* Free the cross-allocated entry which originates from a different bucket. */
-			free(crossCurrent);
-		}
-	}else if(standardCrossAlloc == 0){
-		current = removeAddrFromList(&toRemove, lrzBucket);
-		if(current == NULL){
-			unlock(memL);
-			return 1;
-		}
+	entries->counter = 0;
+	entries->size = size;
+	entries->removed = 0;
+	entries->runs = 0;
+	entries->lastRun = 0;
+	entries->end = NULL;
+	entries->lines = 0;
 
-		firstAddrLock = getLock(lrzBucket);
-		secondAddrLock = getLock(rrzBucket);
+	return entries;
+}
 
-		if(firstAddrLock != secondAddrLock){
-			unlock(memL);
+void freeEntries(void *mem){
+	rzEntries *entries;
+	entries = (rzEntries*) mem;
 
-			if(lock(memR) == 1){
-				free(current);
-				return 1;
-			}
-		}
+	int entryClass;
+	entryClass = getEntryClass(entries->size);
 
-		crossCurrent = removeAddrFromList(&toRemove, rrzBucket);
-		if(crossCurrent == NULL){
-			free(current);
+	if(entryClass == -1){
+		free(entries);
+		return;
+	}
 
-			if(firstAddrLock != secondAddrLock){
-				unlock(memL);
-			}
-			return 1;
-		}
+	entryCache *cache;
+	cache = &entryCaches[entryClass];
 
-		if(firstAddrLock != secondAddrLock){
-			if(unlock(memR) == 1){
-				free(current);
-				free(crossCurrent);
+	freeEntry *current;
+	current = (freeEntry*) entries;
 
-				return 1;
-			}
-		}else{
-			unlock(memL);
-		}
+	current->next = cache->first;
+	cache->first = current;
+	cache->counter++;
 
-		/* Free the cross-allocated entry which originates from a different bucket. */
-		free(crossCurrent);
-	}else{
-		/* This branch is used if and only if the left and right red-zone buckets match, meaning only the
-		   left bucket can be used for removing the entry (since the list referred to by both buckets is the same). */
-		current = removeAddrFromList(&toRemove, lrzBucket);
-		if(current == NULL){
-			unlock(memL);
-			return 1;
-		}
+	if(cache->counter > ENTRY_CACHE_LIMIT){
+		flushEntryCache(entryClass, 0);
 	}
+}
 
-	if(unlock(memL) == 1){
-		return 1;
+void lockEntryPool(){
+	pthread_mutex_lock(&entryPoolMutex);
+}
+
+void unlockEntryPool(){
+	pthread_mutex_unlock(&entryPoolMutex);
+}
+/*--------------------------------*/
+
+/*----------------Batch Functions----------------*/
+int compareBatchEntries(const void *first, const void *second){
+	const batchEntry *a;
+	a = (const batchEntry*) first;
+
+	const batchEntry *b;
+	b = (const batchEntry*) second;
+
+	if(a->stripe != b->stripe){
+		return (a->stripe < b->stripe) ? -1 : 1;
 	}
 
-	/* Free the removed entry from the hash table list. */
-	free(current);
+	/* Within a stripe, objects are applied in increasing order, so most of them are appended to their run. */
+	if(a->addr->startAddrL != b->addr->startAddrL){
+		return (a->addr->startAddrL < b->addr->startAddrL) ? -1 : 1;
+	}
 
 	return 0;
 }
 
-int addAddrToList(rzAddr *toAdd, int rzBucket){
-	rzAddr *current;
-	current = NULL;
+void applyBatch(batchEntry *batch, int amount, int (*apply)(batchEntry *entry)){
+	qsort(batch, amount, sizeof(batchEntry), compareBatchEntries);
 
-	rzAddr *prev;
-	prev = NULL;
+	int i;
+	i = 0;
 
-	if(hashTable[rzBucket].counter == 0 && hashTable[rzBucket].first == NULL){
-		/* The new entry will become the first. */
-		hashTable[rzBucket].first = toAdd;
-		hashTable[rzBucket].last = toAdd;
-	}else if(hashTable[rzBucket].last->startAddrR < toAdd->startAddrL){
-		/* It was observed that addresses are often allocated increasingly (in size). Therefore, starting at the end with
-		   adding is more efficient (with this additional branch). */
-		hashTable[rzBucket].last->next = toAdd;
-		hashTable[rzBucket].last = toAdd;
-	}else{
-		for(current = hashTable[rzBucket].first; current != (rzAddr*) NULL; current = current->next){
-			/* Compare the red-zone entry. */
-			if((current->startAddrL == toAdd->startAddrL) || (current->startAddrR == toAdd->startAddrR)){
-				/* Red-zone (or part of it) already in the table. */
-				printf("ERROR: REDZONE ALREADY REGISTERED.\n");
-				return 1;
-			}else if(toAdd->startAddrR < current->startAddrL){
-				if(prev == NULL){
-					hashTable[rzBucket].first = toAdd;
-					toAdd->next = current;
+	while(i < amount){
+		int stripe;
+		stripe = batch[i].stripe;
 
-					break;
-				}else{
-					prev->next = toAdd;
-					toAdd->next = current;
+		if(stripe == -1){
+			i++;
+			continue;
+		}
 
-					break;
-				}
+		if(lockStripe(stripe) == 1){
+			/* Mark the objects of the stripe as failed. */
+			while(i < amount && batch[i].stripe == stripe){
+				batch[i].failed = 1;
+				i++;
+			}
+
+			continue;
+		}
+
+		/* The buckets of the stripe are looked up (by apply) while holding its lock, since a rehash might be moving them. */
+		while(i < amount && batch[i].stripe == stripe){
+			if(apply(&batch[i]) == 1){
+				batch[i].failed = 1;
 			}
 
-			/* Save the previous entry. */
-			prev = current;
+			i++;
 		}
+
+		unlockStripe(stripe);
 	}
+}
 
-	hashTable[rzBucket].counter++;
+int registerBatchL(batchEntry *entry){
+	return addAddrToList(entry->addr, getRZAddrBucket(entry->addr->startAddrL), getPage(entry->addr->startAddrL));
+}
 
-	return 0;
+int registerBatchR(batchEntry *entry){
+	return addAddrToList(entry->addr, getRZAddrBucket(entry->addr->startAddrR), getPage(entry->addr->startAddrR));
 }
 
-int registerAddr(void *memL, void *memR){
-	if(memL == NULL && memR == NULL){
+int removeBatchL(batchEntry *entry){
+	return removeAddrFromList(entry->addr, getRZAddrBucket(entry->addr->startAddrL), getPage(entry->addr->startAddrL));
+}
+
+int removeBatchR(batchEntry *entry){
+	return removeAddrFromList(entry->addr, getRZAddrBucket(entry->addr->startAddrR), getPage(entry->addr->startAddrR));
+}
+
+int registerAddrs(rzAddr *addrs, int amount){
+	if(amount <= 0){
+		return 0;
+	}
+
+	batchEntry *batch;
+	batch = malloc(amount * sizeof(batchEntry));
+	if(batch == NULL){
 		return 1;
 	}
 
-	rzAddr *toAdd;
-	toAdd = NULL;
+	/* Unlike registerAddr, the entries of a cross-page object are added under one lock at a time: first all left
+	   red-zones, then all right ones (holding every lock once per phase). */
+	for(int i = 0; i < amount; i++){
+		batch[i].addr = &addrs[i];
+		batch[i].failed = 0;
+		batch[i].stripe = getLock(getRZAddrHash(addrs[i].startAddrL));
 
-	/* Only exists for cross-page allocations. If the same pointer is used in different lists, list arithmetic
-	   cannot be trusted. */
-	rzAddr *crossToAdd;
-	toAdd = NULL;
+		if(addrs[i].startAddrL == NULL || addrs[i].startAddrR == NULL){
+			batch[i].failed = 1;
+			batch[i].stripe = -1;
+		}
+	}
 
-	int lrzBucket;
-	lrzBucket = -1;
+	applyBatch(batch, amount, registerBatchL);
 
-	int rrzBucket;
-	rrzBucket = -1;
+	for(int i = 0; i < amount; i++){
+		if(batch[i].failed == 0 && getPage(batch[i].addr->startAddrR) != getPage(batch[i].addr->startAddrL)){
+			batch[i].stripe = getLock(getRZAddrHash(batch[i].addr->startAddrR));
+		}else{
+			batch[i].stripe = -1;
+		}
+	}
 
-	int firstAddrLock;
-	firstAddrLock = 0;
+	applyBatch(batch, amount, registerBatchR);
 
-	int secondAddrLock;
-	secondAddrLock = 0;
+	int registered;
+	registered = 0;
 
-	int crossAlloc;
-	crossAlloc = -1;
+	int failed;
+	failed = 0;
 
-	int check;
-	check = -1;
+	for(int i = 0; i < amount; i++){
+		if(batch[i].failed == 0){
+			registered++;
+			continue;
+		}
 
-	if(memL == NULL || memR == NULL){
-		/* Requires two valid red-zone addresses for a register. */
-		return 1;
-	}
+		failed = 1;
 
-	lrzBucket = getRZAddrBucket(memL);
-	rrzBucket = getRZAddrBucket(memR);
+		if(batch[i].stripe != -1){
+			/* Undo the registration in the run of the left red-zone, for an object of which the right one failed. */
+			rzAddr toRemove;
+			toRemove.startAddrL = batch[i].addr->startAddrL;
+			toRemove.startAddrR = batch[i].addr->startAddrR;
 
-	if(lrzBucket != rrzBucket){
-		/* A cross-page allocation occurred, meaning that we require this entry to be saved in different buckets
-		   at the same time. */
-		crossAlloc = 0;
-	}
-	
-	/* The very first bucket is 0, the very last bucket is 255. Check if the selected bucket(s) are valid. */
-	if(!(lrzBucket >= 0 && lrzBucket < HASHSZ)){
-		return 1;
+			if(lock(toRemove.startAddrL) == 0){
+				removeAddrFromList(&toRemove, getRZAddrBucket(toRemove.startAddrL), getPage(toRemove.startAddrL));
+				unlock(toRemove.startAddrL);
+			}
+		}
 	}
 
-	if(!(rrzBucket >= 0 && rrzBucket < HASHSZ)){
-		return 1;
-	}
+	free(batch);
 
-	toAdd = (rzAddr*) malloc(sizeof(struct rzAddr));
-	if(toAdd == NULL){
-		return 1;
+	__atomic_add_fetch(&registeredAddrs, registered, __ATOMIC_RELAXED);
+	for(int i = 0; i < registered; i++){
+		rehashStep();
 	}
 
-	toAdd->startAddrL = memL;
-	toAdd->startAddrR = memR;
-	toAdd->next = NULL;
+	return failed;
+}
 
-	if(lock(memL) == 1){
-		free(toAdd);
-		return 1;
+int removeAddrs(rzAddr *addrs, int amount){
+	if(amount <= 0){
+		return 0;
 	}
 
-	if(crossAlloc == 0){
-		if(addAddrToList(toAdd, lrzBucket) == 1){
-			free(toAdd);
-			unlock(memL);
-			return 1;
-		}
+	/* The log of a thread (the common caller) is small, so its batch is kept on the stack. */
+	batchEntry logBatch[REMOVAL_LOG_SIZE];
 
-		crossToAdd = (rzAddr*) malloc(sizeof(struct rzAddr));
-		if(crossToAdd == NULL){
-			unlock(memL);
+	batchEntry *batch;
+	batch = logBatch;
+
+	if(amount > REMOVAL_LOG_SIZE){
+		batch = malloc(amount * sizeof(batchEntry));
+		if(batch == NULL){
 			return 1;
 		}
+	}
 
-		crossToAdd->startAddrL = memL;
-		crossToAdd->startAddrR = memR;
-		crossToAdd->next = NULL;
+	/* The right red-zone addresses are recovered from the entries of the left ones, so those are removed first. */
+	for(int i = 0; i < amount; i++){
+		batch[i].addr = &addrs[i];
+		batch[i].failed = 0;
+		batch[i].stripe = getLock(getRZAddrHash(addrs[i].startAddrL));
 
-		firstAddrLock = getLock(lrzBucket);
-		secondAddrLock = getLock(rrzBucket);
+		if(addrs[i].startAddrL == NULL){
+			printf("ERROR: INVALID STARTING ADDRESS PROVIDED.\n");
+			batch[i].failed = 1;
+			batch[i].stripe = -1;
+		}
+	}
 
-		if(firstAddrLock != secondAddrLock){
-			if(unlock(memL) == 1){
-				free(crossToAdd);
-				return 1;
-			}
+	applyBatch(batch, amount, removeBatchL);
 
-			if(lock(memR) == 1){
-				free(crossToAdd);
-				return 1;
-			}
+	for(int i = 0; i < amount; i++){
+		if(batch[i].failed == 0 && getPage(batch[i].addr->startAddrR) != getPage(batch[i].addr->startAddrL)){
+			batch[i].stripe = getLock(getRZAddrHash(batch[i].addr->startAddrR));
+		}else{
+			batch[i].stripe = -1;
 		}
+	}
 
-		if(addAddrToList(crossToAdd, rrzBucket) == 1){
-			/* If this occurs, everything will break. */
-			free(crossToAdd);
+	applyBatch(batch, amount, removeBatchR);
 
-			if(firstAddrLock != secondAddrLock){
-				unlock(memR);
-			}else{
-				unlock(memL);
-			}
-			
-			if(removeAddr(memL, memR) == 1){
-				/* Fatal memory error. */
-			}
+	int removed;
+	removed = 0;
 
-			return 1;
-		}
+	int failed;
+	failed = 0;
 
-		if(firstAddrLock != secondAddrLock){
-			if(unlock(memR) == 1){
-				return 1;
-			}
+	for(int i = 0; i < amount; i++){
+		if(batch[i].failed == 0){
+			removed++;
 		}else{
-			if(unlock(memL) == 1){
-				return 1;
-			}
-		}
-		
-	}else{
-		if(addAddrToList(toAdd, lrzBucket) == 1){
-			free(toAdd);
-			unlock(memL);
-
-			return 1;
+			failed = 1;
 		}
+	}
 
-		if(unlock(memL) == 1){
-			return 1;
-		}
+	if(batch != logBatch){
+		free(batch);
+	}
 
+	/* Invalidate the objects cached by all threads once for the whole batch. */
+	__atomic_add_fetch(&removalGeneration, 1, __ATOMIC_RELEASE);
+	__atomic_sub_fetch(&registeredAddrs, removed, __ATOMIC_RELAXED);
+	for(int i = 0; i < removed; i++){
+		rehashStep();
 	}
 
-	return 0;
+	return failed;
 }
 
-int insertRZPattern(void *mem, size_t size){
-	if(init == 0){
-		if(initLib() == 1){
-			printf("ERROR: INITIALISATION OF LIBRARY FAILED.\n");
-			return 1;
-		}
+void flushRemovalLog(){
+	if(removalCount == 0){
+		return;
 	}
 
-	/* Use a custom size for global, stack, or static objects (specified, customisable). If the size
-	   is either 0 (standard whenever not using a custom size) or not a multiple of 8, also use
-	   the standard size (red-zone size, defined by scale). */
-	int amount;
-	if(size == 0 || size % 8 != 0){
-		amount = rz_sz;
-	}else{
-		amount = size;
+	if(removeAddrs(removalLog, removalCount) == 1){
+		printf("ERROR: FAILED TO REMOVE ADDRESS FROM HASH TABLE.\n");
 	}
 
-	if(memset(mem, redzone, amount) == NULL){
-		return 1;
+	/* Only now the memory can be reused, since it is no longer registered. */
+	for(int i = 0; i < removalCount; i++){
+		free(removalLog[i].startAddrL);
 	}
 
-	return 0;
+	removalCount = 0;
 }
+/*--------------------------------*/
 
 /* This function assumes alignment is in order when freeing memory. */
 void Dlib_free(void *mem){
@@ -848,6 +2082,21 @@ void Dlib_free(void *mem){
 	/* Return the pointer to the actual start of the contiguous memory region. */
 	mem = mem - rz_sz;
 
+	/* The epoch record of the thread is needed, so its log is flushed when it exits. */
+	if(useDeferredRemoval == 0 && getEpochRecord() != NULL){
+		/* Log the deallocation. The memory is not freed yet, so its red-zones keep their pattern, and accesses to
+		   them are still detected until the batch is applied. */
+		removalLog[removalCount].startAddrL = mem;
+		removalLog[removalCount].startAddrR = NULL;
+		removalCount++;
+
+		if(removalCount == REMOVAL_LOG_SIZE){
+			flushRemovalLog();
+		}
+
+		return;
+	}
+
 	/* Remove the left and right red-zone entry from the red-zone hash table register. The right red-zone address is not
 	   explicitily recoverable. However, the left red-zone address suffices, since all blocks of red-zone entries 
 	   keep both the left and right starting addresses of its respective red-zones. */
@@ -1017,6 +2266,83 @@ void *Dlib_calloc(size_t num, size_t sz){
 	return mem;
 }
 
+void **Dlib_independent_calloc(size_t num, size_t sz, void **chunks){
+	if(init == 0){
+		if(initLib() == 1){
+			printf("ERROR: INITIALISATION OF LIBRARY FAILED.\n");
+			return NULL;
+		}
+	}
+
+	if(num <= 0 || sz <= 0){
+		return NULL;
+	}
+
+	void **objects;
+	objects = chunks;
+
+	if(objects == NULL){
+		objects = malloc(num * sizeof(void*));
+		if(objects == NULL){
+			return NULL;
+		}
+	}
+
+	rzAddr *addrs;
+	addrs = malloc(num * sizeof(rzAddr));
+	if(addrs == NULL){
+		if(chunks == NULL){
+			free(objects);
+		}
+
+		return NULL;
+	}
+
+	size_t ac_sz;
+	ac_sz = sz + (2 * rz_sz);
+
+	for(size_t i = 0; i < num; i++){
+		void *mem;
+		mem = calloc(1, ac_sz);
+
+		if(mem == NULL){
+			/* None of the objects are registered yet, so they can simply be freed. */
+			for(size_t j = 0; j < i; j++){
+				free(addrs[j].startAddrL);
+			}
+
+			free(addrs);
+			if(chunks == NULL){
+				free(objects);
+			}
+
+			return NULL;
+		}
+
+		if(fastCheckInit == 0){
+			/* Insert pattern into both red-zones. */
+			insertRZPattern(mem, 0);
+			insertRZPattern(mem + rz_sz + sz, 0);
+		}
+
+		addrs[i].startAddrL = mem;
+		addrs[i].startAddrR = mem + rz_sz + sz;
+
+		objects[i] = mem + rz_sz;
+	}
+
+	if(useRegistration == 0){
+		/* Register all objects at once, taking every lock once instead of once per object. */
+		if(registerAddrs(addrs, num) == 1){
+			printf("ERROR: REGISTRATION DENIED.\n");
+		}
+	}
+
+	free(addrs);
+
+	return objects;
+}
+
 void *Dlib_memalign(size_t alignment, size_t sz){
 	void *mem;
 	mem = NULL;
@@ -4,20 +4,137 @@
 #include <dlfcn.h>
 #include <stddef.h>
 
+//Initial (and minimum) amount of buckets of the hash table.
 #define HASHSZ 4096
 
+//The table is doubled once the average amount of registered objects per bucket exceeds HASH_MAX_LOAD, and halved once it
+//drops below HASH_MIN_LOAD.
+#define HASH_MAX_LOAD 16
+#define HASH_MIN_LOAD 2
+
+//Hash functions for the page numbers of red-zone addresses, selected by hashFunction.
+#define HASH_XOR_FOLD 0
+#define HASH_FIBONACCI 1
+#define HASH_CRC32C 2
+
+//Amount of buckets moved to the new table per registration/removal during a rehash.
+#define REHASH_STEP 4
+
+//A lock protecting a stripe of buckets. Its state is 0 when unlocked, 1 when locked, and 2 when locked with (possibly)
+//parked threads waiting for it. Every lock has its own cache line, to avoid false sharing between threads using different
+//stripes.
+typedef struct bucketLock{
+	int state;
+}__attribute__((aligned(64))) bucketLock;
+
+//Minimum amount of words in the array of a bucket.
+#define BUCKET_INITIAL_SIZE 4
+
+//Amount of recently found objects cached by every thread, in front of the 'slow' check.
+#define HIT_CACHE_SIZE 4
+
+//Amount of deallocations a thread logs before their removals are applied (and their memory is freed) in a batch.
+#define REMOVAL_LOG_SIZE 64
+
+//Amount of executions of a check site per check, for programs instrumented with -hm-sample-checks.
+#define SAMPLE_RATE 100
+
+//Amount of retired memory regions a thread keeps before it has to wait for them to be freed.
+#define RETIRE_LIMIT 64
+
+//Arrays of entries are allocated from size classes of BUCKET_INITIAL_SIZE << N words, for N < ENTRY_CLASSES (larger
+//arrays use malloc()). Every thread caches up to ENTRY_CACHE_LIMIT free arrays per class, and exchanges them with a global
+//pool in batches of ENTRY_BATCH. New arrays are carved from slabs of ENTRY_SLAB_SIZE bytes.
+#define ENTRY_CLASSES 10
+#define ENTRY_CACHE_LIMIT 128
+#define ENTRY_BATCH 32
+#define ENTRY_SLAB_SIZE 65536
+
 typedef struct rzAddr{
 	void *startAddrL;
 	void*startAddrR;
-	struct rzAddr *next;
 }rzAddr;
 
-typedef struct rzHashBucket{
+//Entries are packed into words, grouped in runs: one for every page with a registered red-zone in the bucket. A run starts
+//with a header word holding the page number (above RUN_COUNT_BITS) and its amount of entries, followed by its entries,
+//sorted on the address of their left red-zone. An entry holds the offset in the page of the red-zone it is registered for
+//(its left red-zone, or its right one for an object starting on an earlier page, marked by ENTRY_ANCHOR_R), and the
+//distance between both red-zones (above ENTRY_SIZE_SHIFT). Removed entries are marked by ENTRY_REMOVED.
+#define RUN_COUNT_BITS 16
+#define RUN_COUNT_MASK 0xFFFFUL
+#define ENTRY_OFFSET_MASK 0xFFFFUL
+#define ENTRY_ANCHOR_R 0x10000UL
+#define ENTRY_REMOVED 0x20000UL
+#define ENTRY_SIZE_SHIFT 18
+
+//The runs of a bucket, sorted on their page number. Since the 'slow' check reads them without a lock, a published array is
+//only modified by appending words after counter (updating the header of the last run), and by marking entries as removed.
+//Any other modification publishes a new array.
+typedef struct rzEntries{
+	//Amount of used (and available) words, headers included.
 	unsigned int counter;
-	rzAddr *first;
-	rzAddr *last;
+	unsigned int size;
+	unsigned int removed;
+	unsigned int runs;
+	//Index of the header of the last run.
+	unsigned int lastRun;
+	//Highest right red-zone address of all entries.
+	void *end;
+	//Bitmap of the lines (a 64th of a page) containing a red-zone of the entries, see getEntryLines. Bits of removed
+	//entries are only cleared once the array is copied.
+	unsigned long int lines;
+	unsigned long int entries[];
+}rzEntries;
+
+typedef struct rzHashBucket{
+	rzEntries *entries;
 }rzHashBucket;
 
+//The buckets of the hash table, and those of the table being rehashed into them (NULL if no rehash is ongoing). Buckets of
+//the old table below rehashIndex have already been moved. Table sizes are always a power of two.
+typedef struct rzTableState{
+	rzHashBucket *buckets;
+	unsigned long int size;
+	rzHashBucket *oldBuckets;
+	unsigned long int oldSize;
+	unsigned long int rehashIndex;
+}rzTableState;
+
+//Per-thread record for the epoch-based reclamation. Its state is 0 when the thread is not reading the table, and
+//(epoch << 1) | 1 while it is.
+typedef struct epochRecord{
+	unsigned long int state;
+	int inUse;
+	struct epochRecord *next;
+}__attribute__((aligned(64))) epochRecord;
+
+typedef struct retiredMemory{
+	void *mem;
+	void (*destroy)(void *mem);
+	unsigned long int epoch;
+}retiredMemory;
+
+//A free array of entries, linked in the cache of a thread, or in a batch of the global pool. The first array of a batch
+//holds the amount of arrays in it, and links to the next batch.
+typedef struct freeEntry{
+	struct freeEntry *next;
+	struct freeEntry *nextBatch;
+	unsigned int counter;
+}freeEntry;
+
+typedef struct entryCache{
+	freeEntry *first;
+	unsigned int counter;
+}entryCache;
+
+//An object in a batch of registrations or removals, with the stripe of the lock it is applied under (or -1 if it is
+//skipped), and whether applying it failed.
+typedef struct batchEntry{
+	rzAddr *addr;
+	int stripe;
+	int failed;
+}batchEntry;
+
 //The scale variable used for determining the red-zone size.
 extern size_t scale;
 
@@ -25,12 +142,17 @@ extern size_t scale;
 //in any alignment issues for the red-zone pattern (unlike the 8-byte pattern).
 extern unsigned char redzone;
 
+//The sample rate of the check sites instrumented with -hm-sample-checks.
+extern int __hmbounds_sample_rate;
+
+//Whether the checks of a program instrumented with -hm-clone-unchecked are enabled for the current thread.
+extern __thread int __hmbounds_checks_enabled;
+
 /*----------------Initialisation Functions----------------*/
 //Calculates the size of the red-zone. Should be done once at startup, result saved in a constant.
 size_t calcRZSize(size_t sz);
 
-//Destroys mutexes, and sets the initialisation variable to 0 to ensure the library crashes/exhibits undefined
-//behaviour if improperly unloaded.
+//Sets the initialisation variable to 0 to ensure the library crashes/exhibits undefined behaviour if improperly unloaded.
 int unloadLib();
 
 //Initialises some needed variables/data/etc.
@@ -38,8 +160,15 @@ int initLib();
 /*--------------------------------*/
 
 /*----------------General Functions----------------*/
-//Examine which lock must be acquired which is to be locked by the caller.
-int getLock(int bucket);
+//Examine which lock must be acquired which is to be locked by the caller, by using the hash of a red-zone address.
+int getLock(unsigned long int hash);
+
+//Acquire a lock by its index. Spins for a bounded amount of attempts, after which the thread is parked (futex) until
+//the lock is released.
+int lockStripe(int stripe);
+
+//Release a lock by its index, waking a parked thread if there is one.
+int unlockStripe(int stripe);
 
 //Unlock a lock by using a memory address, which functions as an indicator of the bucket in the hash table.
 int unlock(void *mem);
@@ -47,8 +176,65 @@ int unlock(void *mem);
 //Acquire a lock by using a memory address, which functions as an indicator of the bucket in the hash table.
 int lock(void *mem);
 
-//Calculate hash bucket for given red-zone memory address.
-int getRZAddrBucket(void *mem);
+//Acquire (release) the locks of both red-zone addresses of an object, in a fixed order.
+int lockPair(void *memL, void *memR);
+int unlockPair(void *memL, void *memR);
+
+//Acquire (release) all locks, used when swapping the table states of a rehash.
+void lockAll();
+void unlockAll();
+
+//Calculate the hash of a page number with one of the hash functions above. Exposed for benchmarking them.
+unsigned long int hashPage(unsigned long int page, int function);
+
+//Calculate the hash for given red-zone memory address.
+unsigned long int getRZAddrHash(void *mem);
+
+//Get the hash bucket for given red-zone memory address, taking an ongoing rehash into account. The lock of the address
+//must be held (or, for reading only, the thread must be in an epoch).
+rzHashBucket *getRZAddrBucket(void *mem);
+
+//Get the page number of a memory address.
+unsigned long int getPage(void *mem);
+
+//Unpack the left (right) red-zone address of an entry in the run of the given page.
+void *getEntryAddrL(unsigned long int page, unsigned long int entry);
+void *getEntryAddrR(unsigned long int page, unsigned long int entry);
+
+//Pack a red-zone entry for the run of the given page, which must contain one of its red-zones.
+unsigned long int packEntry(rzAddr *addr, unsigned long int page);
+
+//Get the bit of the line of a memory address in the bitmap of an array.
+unsigned long int getLineBit(void *mem);
+
+//Get the bits of the lines covered by a red-zone starting at the given memory address.
+unsigned long int getRZLines(void *mem);
+
+//Get the bits of the lines covered by the red-zones of an entry which start on the page of its run.
+unsigned long int getEntryLines(unsigned long int page, unsigned long int entry);
+
+//Find the index of the header of the run of a page, among the first counter words of the array. Its amount of entries is
+//written into runCount. Returns -1 if the page has no run.
+int findRunInList(unsigned long int page, rzEntries *entries, unsigned int counter, unsigned int *runCount);
+
+//Find the index of the last entry in the run of the given page with a left red-zone at or before the given memory address
+//(binary search). Returns -1 if there is no such entry.
+int findAddrInList(void *mem, unsigned long int page, rzEntries *entries);
+
+//Check if a single memory address lies in a red-zone registered in the run of the given page. Must be called in an epoch.
+//If an object containing the address (including its red-zones) is found, it is written into hit.
+int checkAddrInRun(void *mem, unsigned long int page, rzAddr *hit);
+
+//Check a single memory address against the objects cached by the current thread. Returns -1 if none of them contains it.
+//The generation of removals the cache is valid for is written into generation.
+int checkHitCache(void *mem, unsigned long int *generation);
+
+//Cache an object found by the current thread, unless objects have been removed since the given generation.
+void addHitCache(rzAddr *hit, unsigned long int generation);
+
+//Check if a single memory address lies in a registered red-zone, starting on its own page or the previous one. Acquires
+//no lock.
+int checkAddrInList(void *mem);
 
 //Check if the selected memory (for access) is addressable, or poisoned (red-zone), through the hash table memory registration.
 //This is also defined as the 'slow' check, performed after a 'fast' check determines the red-zone pattern is available.
@@ -60,14 +246,32 @@ int checkRegistration(void *mem, int accessSize);
 //variant of this library.
 int checkMemoryAccess(void *mem, int accessSize);
 
-//Remove registered red-zone address from its respective bucket in the hash table.
-rzAddr *removeAddrFromList(rzAddr* toRemove, int rzBucket);
+//Look up the red-zones overlapping a range in the hash table, through both ends of the range and the addresses at a stride
+//of the red-zone size in between.
+int checkRangeRegistration(void *mem, size_t size);
+
+//Check if any byte of a range lies in a red-zone, used for all accesses of a loop at once (checked before the loop). Only
+//the runs of the red-zone pattern in the range are looked up in the hash table.
+int checkMemoryRange(void *mem, size_t size);
+
+//Remove registered red-zone address from the run of the given page in its respective bucket in the hash table. The right
+//red-zone address of the removed entry is written back into toRemove.
+int removeAddrFromList(rzAddr* toRemove, rzHashBucket *bucket, unsigned long int page);
 
 //Remove red-zone address from red-zone hash table on deallocation.
 int removeAddr(void *memL, void *memR);
 
-//Add registered red-zone address to its respective bucket in the hash table.
-int addAddrToList(rzAddr *toAdd, int rzBucket);
+//Append an entry to the run of the given page in an unpublished array, starting a new run if the last one is of another page.
+void appendEntry(rzEntries *to, unsigned long int page, unsigned long int entry);
+
+//Copy an array of entries, leaving out the removed entries, and inserting toAdd (if not NULL) in the run of the given page.
+rzEntries *copyEntries(rzEntries *from, rzAddr *toAdd, unsigned long int page);
+
+//Replace the array of entries of a bucket, retiring the old array.
+void publishEntries(rzHashBucket *bucket, rzEntries *entries);
+
+//Add registered red-zone address to the run of the given page in its respective bucket in the hash table.
+int addAddrToList(rzAddr *toAdd, rzHashBucket *bucket, unsigned long int page);
 
 //Register red-zone address in red-zone hash table.
 int registerAddr(void *memL, void *memR);
@@ -78,6 +282,100 @@ int registerAddr(void *memL, void *memR);
 int insertRZPattern(void *mem, size_t size);
 /*--------------------------------*/
 
+/*----------------Rehash Functions----------------*/
+//Move the entries of a bucket of the old table to the new table.
+int rehashBucket(rzTableState *state, unsigned long int oldBucket);
+
+//Allocate a new table of the given size, and start rehashing into it.
+int beginRehash(rzTableState *state, unsigned long int newSize);
+
+//Release the old table once all of its buckets have been moved.
+int finishRehash(rzTableState *state);
+
+//Perform a part of an ongoing rehash, or start one if the load of the table requires it. Called on every registration
+//and removal.
+void rehashStep();
+/*--------------------------------*/
+
+/*----------------Epoch Functions----------------*/
+//Create the key used to release the epoch record of a thread on its exit.
+void createEpochKey();
+
+//Fork handlers (pthread_atfork), so the child does not inherit locked stripes, a locked rehash mutex or entry pool, or the
+//epoch records of threads it does not have.
+void prepareFork();
+void parentFork();
+void childFork();
+
+//Free the retired memory of an exiting thread, and release its epoch record.
+void destroyEpochRecord(void *record);
+
+//Get (or create) the epoch record of the current thread.
+epochRecord *getEpochRecord();
+
+//Announce that the current thread starts (stops) reading the hash table without locks.
+int enterEpoch();
+void exitEpoch();
+
+//Advance the global epoch if all reading threads have observed it. Returns the (new) global epoch.
+unsigned long int tryAdvanceEpoch();
+
+//Free the memory retired by the current thread which can no longer be referenced by any reader.
+void reclaimMemory();
+
+//Free memory which has been unlinked from the hash table (with the given function), once no reader can still reference it.
+void retireMemory(void *mem, void (*destroy)(void *mem));
+/*--------------------------------*/
+
+/*----------------Entry Pool Functions----------------*/
+//Get the size class of an array of entries of the given size, or -1 if it has none.
+int getEntryClass(unsigned int size);
+
+//Get the size in bytes of an array of entries of a size class.
+size_t getEntryClassSize(int entryClass);
+
+//Fill the (empty) cache of a size class, from the global pool or from a new slab.
+int refillEntryCache(int entryClass);
+
+//Return a batch of cached arrays of a size class to the global pool, or all of them if all is not 0.
+void flushEntryCache(int entryClass, int all);
+
+//Allocate an (empty) array of entries for a bucket.
+rzEntries *allocateEntries(unsigned int size);
+
+//Free an array of entries, to the cache of the current thread.
+void freeEntries(void *mem);
+
+//Used around a fork, so the child does not inherit a locked pool.
+void lockEntryPool();
+void unlockEntryPool();
+/*--------------------------------*/
+
+/*----------------Batch Functions----------------*/
+//Order the objects of a batch on the stripe of their lock, and on their address within a stripe.
+int compareBatchEntries(const void *first, const void *second);
+
+//Apply a function to the objects of a batch, taking the lock of every stripe once. Objects for which it returns 1 are
+//marked as failed.
+void applyBatch(batchEntry *batch, int amount, int (*apply)(batchEntry *entry));
+
+//Add (remove) an object of a batch to (from) the run of the page of its left or right red-zone.
+int registerBatchL(batchEntry *entry);
+int registerBatchR(batchEntry *entry);
+int removeBatchL(batchEntry *entry);
+int removeBatchR(batchEntry *entry);
+
+//Register the red-zone addresses of a number of objects in the hash table, locking every stripe once.
+int registerAddrs(rzAddr *addrs, int amount);
+
+//Remove the red-zone addresses of a number of objects (of which only the left one is required) from the hash table,
+//locking every stripe once.
+int removeAddrs(rzAddr *addrs, int amount);
+
+//Apply the removals logged by the current thread, and free their memory.
+void flushRemovalLog();
+/*--------------------------------*/
+
 //Wrapped free. Initiates the additional deallocation checks.
 void Dlib_free(void *mem);
 
@@ -90,6 +388,11 @@ void *Dlib_realloc(void *mem, size_t nsz);
 //Wrapped calloc.
 void *Dlib_calloc(size_t num, size_t sz);
 
+//Allocate num separate (zeroed) objects of sz bytes, registered in a single batch, like independent_calloc() of dlmalloc.
+//The pointers are stored in chunks, or in a newly allocated array if chunks is NULL. Every object is freed separately.
+//Library API only: the pass does not map any call to it, since the shadow memory runtime has no counterpart.
+void **Dlib_independent_calloc(size_t num, size_t sz, void **chunks);
+
 //Wrapped memalign. Still fix for posix_memalign?
 void *Dlib_memalign(size_t alignment, size_t sz);
 
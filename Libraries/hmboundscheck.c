@@ -19,6 +19,26 @@
 #define SIZE ((1ULL<<ADDRSPACE_BITS) / 8)
 #define LOC 0x6600000000ULL
 
+//The shadow memory is pre-faulted in chunks of the size of a transparent huge page (2 MB on x86-64), which covers 16 MB of heap.
+#define SHADOW_CHUNK_SIZE (1ULL << 21)
+#define SHADOW_WINDOWS 4
+
+//Amount of shadow chunks in the complete shadow memory, used for the accounting of the written chunks.
+#define SHADOW_CHUNKS (SIZE / SHADOW_CHUNK_SIZE)
+
+//Prefix of the memory accounting report, equal to the one used by the benchmark-utils reports.
+#define REPORT_PREFIX "[setup-report] "
+
+//Largest part of a range (see checkMemoryRange) checked as a single access.
+#define RANGE_PART (1 << 30)
+
+//Amount of executions of a check site per check, for programs instrumented with -hm-sample-checks.
+#define SAMPLE_RATE 100
+
+//Modes for the shadow memory of a child process after a fork().
+#define FORK_SHADOW_COPY 0
+#define FORK_SHADOW_WIPE 1
+
 //The following macro computes the offset into the byte (array).
 #define BIT_OFFSET(bit) ((bit) / 8)
  
@@ -51,12 +71,76 @@ size_t scale = 7;
 //for this, but can be changed to anything (as long as it is 8 bits/1 byte long).
 unsigned char redzone = 0xFF;
 
+//A check site instrumented with -hm-sample-checks is checked once in every __hmbounds_sample_rate executions (and on every
+//execution once it found a red-zone access). Can be set at start-up with the HMBOUNDS_SAMPLE_RATE environment variable.
+int __hmbounds_sample_rate = SAMPLE_RATE;
+
+//Checks are only done while __hmbounds_checks_enabled is set for the thread, in programs instrumented with
+//-hm-clone-unchecked (where every function runs an unchecked copy of itself while it is clear).
+__thread int __hmbounds_checks_enabled = 1;
+
 //Size of the red-zone, determined by the scale variable.
 static size_t rz_sz = 0;
 
 //Starting variable.
 static int init = 0;
 
+//Size of the system pages, used for pre-faulting the shadow memory when huge pages are unavailable.
+static unsigned long int pagesz = 0;
+
+//A window of shadow memory that has already been pre-faulted. A few windows are kept, since the heap (brk) and the
+//mmap() regions used for large allocations lie far apart in the address space.
+typedef struct shadowWindow{
+	unsigned long long int start;
+	unsigned long long int end;
+}shadowWindow;
+
+static shadowWindow shadowWindows[SHADOW_WINDOWS];
+
+//The window that is replaced next whenever a shadow chunk outside of all windows is pre-faulted.
+static int nextShadowWindow = 0;
+
+//Amount of shadow chunks pre-faulted beyond the end of the chunk(s) needed for a registration. A larger value results in
+//fewer (but larger) bulk pre-faults whenever the heap grows.
+static size_t shadowPrefaultAhead = 1;
+
+//Amount of shadow chunks pre-faulted so far. Compare against the minor page faults (getrusage) to tune the values above.
+size_t shadowPrefaultedChunks = 0;
+
+//Set once the fork handlers have been installed.
+static int forkHandlers = 0;
+
+//Bitmap of the shadow chunks written (or pre-faulted) at least once, one bit per chunk. Only these chunks are inspected with
+//mincore() when the committed shadow memory is reported, instead of the entire (mostly unused) mapping.
+static unsigned char shadowChunkMap[SHADOW_CHUNKS / 8];
+
+//Bytes of the red-zones of all live allocations (including the red-zones of the free-list blocks).
+static size_t redzoneBytes = 0;
+
+//Bytes of memory cached in the free-lists, ready for re-use.
+static size_t freeListBytes = 0;
+
+//Bytes of allocator metadata (the memSeg entries of the free-lists).
+static size_t metadataBytes = 0;
+
+//Set once the memory accounting report has been registered to run at exit.
+static int reportHandler = 0;
+
+//Allocations of at least this size are served as guarded blocks (only used if useGuardPages is enabled).
+static size_t guardPageThreshold = 256 * 1024;
+
+//The table of guarded blocks, sorted on the start of their mappings, and the range of addresses covered by all of them. A check
+//only searches the table if the address lies within this range. Protected by its own lock, since it is only used on the slow
+//paths (the allocation and deallocation of large blocks, and failed checks).
+static guardedBlock *guardedBlocks = NULL;
+static size_t guardedBlockCount = 0;
+static size_t guardedBlockCapacity = 0;
+
+static unsigned long long int guardedLow = 0;
+static unsigned long long int guardedHigh = 0;
+
+static pthread_mutex_t guardedLock = PTHREAD_MUTEX_INITIALIZER;
+
 /*----------------Environment Variables----------------*/
 
 //SET TO 0 TO ENABLE!
@@ -65,6 +149,7 @@ static int init = 0;
 //Variable for activating red-zone poison pattern checking. Deactivating this option will also disable all
 //red-zone pattern insertion, meaning red-zones will no longer be explicitly poisoned. Only the 'slow' check will be used here,
 //resulting in a performance decrease, but an increase in memory efficiency (since the red-zones will no longer be intialised).
+//Programs instrumented with the inline fast path of the pass (-hm-inline-fast-path, on by default) require this option.
 static int fastCheckInit = 0;
 
 //Variable for activating the different method of keeping track of addressibility in the shadow memory. The first, which is
@@ -98,6 +183,41 @@ int standardPreAllocSize = 10;
 //but will probably increase performance as well. 
 static int useRegistration = 0;
 
+//Variable for backing the shadow memory with transparent huge pages. If enabled, the shadow memory is advised to use huge pages
+//(MADV_HUGEPAGE), and the shadow chunks covering newly used heap memory are pre-faulted in bulk, instead of page by page on the
+//first touch inside of the registration memsets. This smooths out allocation latency and reduces dTLB misses on the check path,
+//at the cost of committing shadow memory in steps of SHADOW_CHUNK_SIZE bytes.
+static int useHugeShadow = 1;
+
+//Variable for the fork-aware mode, for programs that warm up their heap and then fork (many) worker processes. If enabled,
+//the shadow memory is handled at fork() as chosen by forkShadowMode. Only FORK_SHADOW_WIPE changes the behaviour: the child
+//then forgets the pre-fault windows of the parent (pthread_atfork()), so its new shadow memory is committed in bulk again.
+//With FORK_SHADOW_COPY, the shadow memory is inherited copy-on-write, exactly as with the mode disabled.
+static int useForkShadow = 1;
+
+//What the shadow memory looks like in a child process (only used if useForkShadow is enabled). With FORK_SHADOW_COPY, the
+//child inherits the shadow memory copy-on-write, which keeps all inherited objects checked. With FORK_SHADOW_WIPE, the shadow
+//memory is mapped MADV_WIPEONFORK: fork() does not copy its page tables and the child starts with a clean (addressable) shadow
+//memory, rebuilding it for its own allocations only. Inherited objects are no longer checked in that case, but are never
+//reported falsely either. (MADV_DONTFORK cannot be used, since every check in the child reads the shadow memory.)
+static int forkShadowMode = FORK_SHADOW_COPY;
+
+//Variable for the memory accounting of the library. If enabled, the committed shadow memory (measured with mincore() over
+//the written shadow chunks), the red-zone bytes, the bytes cached in the free-lists and the metadata bytes are kept track of,
+//and reported at exit as [setup-report] keys (see getShadowMemoryStats() to read them at any other moment).
+static int shadowAccounting = 1;
+
+//Variable for the guard-page mode for large allocations. If enabled, allocations of at least guardPageThreshold bytes get no
+//red-zones, but their own mmap() region, with the payload right-aligned against a PROT_NONE guard page (rounded up to 16 bytes
+//for alignment, the slack is poisoned with the red-zone pattern). Overflows trap in hardware, and the shadow memory of these
+//blocks is never written: a check that fails on (stale) shadow memory, or that hits the poisoned slack, consults the table of
+//guarded blocks before reporting. Only used with the standard allocator (useFreeLists disabled).
+static int useGuardPages = 1;
+
+//Variable for an additional guard page in front of guarded blocks (only used if useGuardPages is enabled). Since the payload is
+//right-aligned, underflows only reach this page after passing the (less than a page of) slack in front of the payload.
+static int useLeftGuardPage = 1;
+
 //OPTIONS:
 //All enabled (a fast check, using shadow memory for the slow check, and the ASAN method for checking values).
 
@@ -143,9 +263,235 @@ int initShadowMemory(){
 		return 1;
 	}
 
+	if(useForkShadow == 0 && forkShadowMode == FORK_SHADOW_WIPE){
+#ifdef MADV_WIPEONFORK
+		if(madvise(shadowMemStart, SIZE, MADV_WIPEONFORK) == -1){
+			printf("WARNING: FAILED TO MARK THE SHADOW MEMORY AS WIPE-ON-FORK.\n");
+		}
+#else
+		printf("WARNING: WIPE-ON-FORK UNSUPPORTED, SHADOW MEMORY IS COPIED ON FORK.\n");
+#endif
+	}
+
+	if(useHugeShadow == 0){
+		/* Only marks the mapping, nothing is committed here. If transparent huge pages are disabled on the system (or for
+		   this process), the shadow memory is still pre-faulted, but with regular pages. */
+		if(madvise(shadowMemStart, SIZE, MADV_HUGEPAGE) == -1){
+			printf("WARNING: TRANSPARENT HUGE PAGES UNAVAILABLE FOR THE SHADOW MEMORY.\n");
+		}
+	}
+
+	return 0;
+}
+
+void markShadowChunks(void *shadowAddr, size_t sz){
+	/* Mark the shadow chunks covering [shadowAddr, shadowAddr + sz) as written. Atomic, since neighbouring chunks share
+	   a byte of the bitmap. */
+	if(shadowAddr == NULL || sz == 0){
+		return;
+	}
+
+	unsigned long long int first;
+	first = ((unsigned long long int) shadowAddr - LOC) / SHADOW_CHUNK_SIZE;
+
+	unsigned long long int last;
+	last = (((unsigned long long int) shadowAddr + sz - 1) - LOC) / SHADOW_CHUNK_SIZE;
+
+	for(unsigned long long int chunk = first; chunk <= last && chunk < SHADOW_CHUNKS; chunk++){
+		if(!BIT_TST(shadowChunkMap, chunk)){
+			__atomic_fetch_or(&shadowChunkMap[BIT_OFFSET(chunk)], BIT_MASK(chunk), __ATOMIC_RELAXED);
+		}
+	}
+
+	return;
+}
+
+size_t getCommittedShadowMemory(){
+	/* Count the resident pages of all written shadow chunks. Chunks that were never written cannot be committed (the
+	   mapping is MAP_NORESERVE), so they are skipped, a byte of the bitmap (8 chunks) at a time. */
+	if(shadowMemStart == NULL || pagesz == 0){
+		return 0;
+	}
+
+	unsigned char *residency;
+	residency = malloc(SHADOW_CHUNK_SIZE / pagesz);
+	if(residency == NULL){
+		return 0;
+	}
+
+	size_t committed;
+	committed = 0;
+
+	for(unsigned long long int chunk = 0; chunk < SHADOW_CHUNKS; chunk++){
+		if(shadowChunkMap[BIT_OFFSET(chunk)] == 0){
+			chunk = chunk + 7;
+			continue;
+		}
+
+		if(!BIT_TST(shadowChunkMap, chunk)){
+			continue;
+		}
+
+		if(mincore((void*) (LOC + (chunk * SHADOW_CHUNK_SIZE)), SHADOW_CHUNK_SIZE, residency) == -1){
+			continue;
+		}
+
+		for(size_t page = 0; page < SHADOW_CHUNK_SIZE / pagesz; page++){
+			if(residency[page] & 1){
+				committed = committed + pagesz;
+			}
+		}
+	}
+
+	free(residency);
+
+	return committed;
+}
+
+int getShadowMemoryStats(shadowStats *stats){
+	if(stats == NULL){
+		return 1;
+	}
+
+	stats->shadowCommitted = getCommittedShadowMemory();
+	stats->shadowPrefaultedChunks = shadowPrefaultedChunks;
+	stats->redzone = __atomic_load_n(&redzoneBytes, __ATOMIC_RELAXED);
+	stats->freeListCached = __atomic_load_n(&freeListBytes, __ATOMIC_RELAXED);
+	stats->metadata = __atomic_load_n(&metadataBytes, __ATOMIC_RELAXED);
+
+	return 0;
+}
+
+void reportShadowMemory(){
+	shadowStats stats;
+	if(getShadowMemoryStats(&stats) == 1){
+		return;
+	}
+
+	fprintf(stderr, REPORT_PREFIX "begin\n");
+	fprintf(stderr, REPORT_PREFIX "shadow_committed_bytes: %zu\n", stats.shadowCommitted);
+	fprintf(stderr, REPORT_PREFIX "shadow_prefaulted_chunks: %zu\n", stats.shadowPrefaultedChunks);
+	fprintf(stderr, REPORT_PREFIX "redzone_bytes: %zu\n", stats.redzone);
+	fprintf(stderr, REPORT_PREFIX "freelist_cached_bytes: %zu\n", stats.freeListCached);
+	fprintf(stderr, REPORT_PREFIX "metadata_bytes: %zu\n", stats.metadata);
+	fprintf(stderr, REPORT_PREFIX "end\n");
+	fflush(stderr);
+
+	return;
+}
+
+int populateShadowMemory(void *start, size_t len){
+	if(shadowAccounting == 0){
+		markShadowChunks(start, len);
+	}
+
+#ifdef MADV_POPULATE_WRITE
+	/* Commit the entire range at once (Linux 5.14 and up). */
+	if(madvise(start, len, MADV_POPULATE_WRITE) == 0){
+		return 0;
+	}
+#endif
+
+	/* Touch every page of the range for writing. An atomic OR with 0 is used so a concurrent registration in
+	   the same page is never overwritten with a stale value. */
+	for(size_t offset = 0; offset < len; offset += pagesz){
+		__atomic_fetch_or((unsigned char*) (start + offset), 0, __ATOMIC_RELAXED);
+	}
+
+	return 0;
+}
+
+int prefaultShadowMemory(void *shadowAddr, size_t sz){
+	/* Bulk pre-fault the shadow chunks covering [shadowAddr, shadowAddr + sz), unless they already lie in a pre-faulted
+	   window. The windows are only a hint: a lost update between threads results in a redundant pre-fault, or in a
+	   regular first-touch fault, never in incorrect shadow memory. */
+	if(shadowAddr == NULL || sz == 0){
+		return 1;
+	}
+
+	unsigned long long int start;
+	start = (unsigned long long int) shadowAddr & ~(SHADOW_CHUNK_SIZE - 1);
+
+	unsigned long long int end;
+	end = ((unsigned long long int) shadowAddr + sz + SHADOW_CHUNK_SIZE - 1) & ~(SHADOW_CHUNK_SIZE - 1);
+
+	shadowWindow *window;
+	window = NULL;
+
+	for(int i = 0; i < SHADOW_WINDOWS; i++){
+		if(shadowWindows[i].start <= start && end <= shadowWindows[i].end){
+			/* Already pre-faulted, which is the common case. */
+			return 0;
+		}
+
+		if(start <= shadowWindows[i].end && shadowWindows[i].start <= end && shadowWindows[i].end != 0){
+			/* Overlapping or adjacent window, so grow that one instead of starting a new window. */
+			window = &shadowWindows[i];
+		}
+	}
+
+	/* The heap grows, so also pre-fault a few chunks beyond what is needed right now. */
+	end = end + (shadowPrefaultAhead * SHADOW_CHUNK_SIZE);
+
+	if(window == NULL){
+		window = &shadowWindows[nextShadowWindow];
+		nextShadowWindow = (nextShadowWindow + 1) % SHADOW_WINDOWS;
+
+		window->start = start;
+		window->end = start;
+	}
+
+	if(start < window->start){
+		populateShadowMemory((void*) start, window->start - start);
+		shadowPrefaultedChunks = shadowPrefaultedChunks + ((window->start - start) / SHADOW_CHUNK_SIZE);
+
+		window->start = start;
+	}
+
+	if(end > window->end){
+		populateShadowMemory((void*) window->end, end - window->end);
+		shadowPrefaultedChunks = shadowPrefaultedChunks + ((end - window->end) / SHADOW_CHUNK_SIZE);
+
+		window->end = end;
+	}
+
 	return 0;
 }
 
+void prepareFork(){
+	/* A fork() while another thread holds the guardedLock would leave it locked forever in the child, so it is held
+	   across the fork() itself. (The mutexes of the free-lists were removed, see the note below useFreeLists.) */
+	if(useGuardPages == 0){
+		pthread_mutex_lock(&guardedLock);
+	}
+
+	return;
+}
+
+void parentFork(){
+	if(useGuardPages == 0){
+		pthread_mutex_unlock(&guardedLock);
+	}
+
+	return;
+}
+
+void childFork(){
+	if(useGuardPages == 0){
+		pthread_mutex_unlock(&guardedLock);
+	}
+
+	/* With FORK_SHADOW_WIPE, the pre-faulted windows are gone, so forget them and let the next registrations pre-fault the
+	   shadow memory in bulk again. With FORK_SHADOW_COPY they are shared copy-on-write with the parent: pre-faulting them
+	   again would copy whole windows, where copy-on-write only copies the pages actually written. */
+	if(useForkShadow == 0 && forkShadowMode == FORK_SHADOW_WIPE){
+		memset(shadowWindows, 0, sizeof(shadowWindows));
+		nextShadowWindow = 0;
+	}
+
+	return;
+}
+
 size_t calcRZSize(size_t scale){
 	/* The minimum size currently is 32 bytes, where scale N = 5, and the standard size is 128 bytes,
 	   with scale N = 7. */
@@ -174,6 +520,17 @@ int unload(){
 
 int initLib(){
 	/* Function to set up some necessary variables/values. Called upon the use of any (callable) function. */
+	char *sampleRate;
+	sampleRate = getenv("HMBOUNDS_SAMPLE_RATE");
+	if(sampleRate != NULL && atoi(sampleRate) > 0){
+		__hmbounds_sample_rate = atoi(sampleRate);
+	}
+
+	pagesz = sysconf(_SC_PAGESIZE);
+	if(pagesz == 0){
+		return 1;
+	}
+
 	rz_sz = calcRZSize(scale);
 	if(rz_sz == 0){
 		printf("ERROR: FAILED TO ACQUIRE RED-ZONE SIZE, SIZE WAS 0.\n");
@@ -189,6 +546,26 @@ int initLib(){
 		}
 	}
 
+	if((useGuardPages == 0 || (useForkShadow == 0 && forkShadowMode == FORK_SHADOW_WIPE)) && forkHandlers == 0){
+		/* Handlers cannot be removed again, so only install them on the first initialisation. They are only needed
+		   for the guardedLock, and for the pre-fault windows of a wiped shadow memory. */
+		if(pthread_atfork(prepareFork, parentFork, childFork) != 0){
+			printf("ERROR: FAILED TO INSTALL FORK HANDLERS.\n");
+			return 1;
+		}
+
+		forkHandlers = 1;
+	}
+
+	if(shadowAccounting == 0 && reportHandler == 0){
+		if(atexit(reportShadowMemory) != 0){
+			printf("ERROR: FAILED TO REGISTER THE MEMORY ACCOUNTING REPORT.\n");
+			return 1;
+		}
+
+		reportHandler = 1;
+	}
+
 /*	if(useFreeLists == 0){
 		for(int i = 0; i < AMOUNT_OF_LOCKS; i++){
 			if(pthread_mutex_init(&mutexes[i], NULL) != 0){
@@ -385,6 +762,107 @@ int checkRegistration(void *mem, int accessSize){
 	return -1;
 }
 
+int checkShadowWord(unsigned char *shadowAddr, size_t count){
+	/* Returns 1 if any of the count shadow bytes is non-zero. The shadow bytes are loaded as 64-, 32- and 16-bit words, so
+	   the 2, 4 or 8 bytes of a (aligned) 16-, 32- or 64-byte access are tested with a single compare. */
+	unsigned long long int word64;
+	unsigned int word32;
+	unsigned short word16;
+
+	while(count >= 8){
+		memcpy(&word64, shadowAddr, 8);
+		if(word64 != 0){
+			return 1;
+		}
+
+		shadowAddr = shadowAddr + 8;
+		count = count - 8;
+	}
+
+	if(count >= 4){
+		memcpy(&word32, shadowAddr, 4);
+		if(word32 != 0){
+			return 1;
+		}
+
+		shadowAddr = shadowAddr + 4;
+		count = count - 4;
+	}
+
+	if(count >= 2){
+		memcpy(&word16, shadowAddr, 2);
+		if(word16 != 0){
+			return 1;
+		}
+
+		shadowAddr = shadowAddr + 2;
+		count = count - 2;
+	}
+
+	if(count == 1 && *shadowAddr != 0){
+		return 1;
+	}
+
+	return 0;
+}
+
+int checkRegistrationVector(void *mem, int accessSize){
+	/* Check every granule covered by an access larger than 8 bytes (e.g., a 16-, 32- or 64-byte vector access), instead of
+	   only the first and last byte of it, which would accept an access spanning an entire red-zone. */
+	unsigned char *shadowAddr;
+	shadowAddr = getShadowMemoryAddress(mem);
+
+	if(shadowAddr == NULL){
+		return -1;
+	}
+
+	if(ASANCheckInit == 0){
+		/* The access ends end bytes after the start of its first granule. All granules accessed up to their last byte must
+		   be fully addressable (0), the granule containing the end of the access (if any) must have at least rem addressable
+		   bytes. */
+		size_t end;
+		end = ((unsigned long long int) mem & 7) + (size_t) accessSize;
+
+		size_t whole;
+		whole = end / 8;
+
+		size_t rem;
+		rem = end % 8;
+
+		if(checkShadowWord(shadowAddr, whole) == 1){
+			return 1;
+		}
+
+		if(rem != 0){
+			unsigned char var;
+			var = shadowAddr[whole];
+
+			if(var != 0 && (var >= 8 || rem > var)){
+				return 1;
+			}
+		}
+
+		return 0;
+	}else{
+		/* The bit-flip method has no single value per granule to compare, so check the access 8 bytes at a time. */
+		for(int offset = 0; offset < accessSize; offset += 8){
+			int size;
+			size = accessSize - offset;
+			if(size > 8){
+				size = 8;
+			}
+
+			if(checkRegistration(mem + offset, size) == 1){
+				return 1;
+			}
+		}
+
+		return 0;
+	}
+
+	return -1;
+}
+
 int checkMemoryAccess(void *mem, int accessSize){
 	/* Returns a negative integer if the address was invalid, 0 if there was no match, and a positive integer
     if the patterns are equal. */
@@ -403,6 +881,24 @@ int checkMemoryAccess(void *mem, int accessSize){
 	check = 0;
 
 	if(useRegistration == 0){
+		if(accessSize > 8){
+			/* Vector accesses can span an entire red-zone between their first and last byte, which the fast check cannot see,
+			   so the shadow memory of all of their granules is checked instead. */
+			check = checkRegistrationVector(mem, accessSize);
+			if(useGuardPages == 0){
+				/* The shadow memory of guarded blocks is never registered (and is clean over their slack), so the table
+				   decides instead. */
+				int guarded;
+				guarded = checkGuardedBlock(mem, accessSize);
+
+				if(guarded != -1){
+					check = guarded;
+				}
+			}
+
+			return check;
+		}
+
 		if(fastCheckInit == 0 && useFreeLists == 1){
 			/* Perform a fast check. If the pattern matches, do a slow check to see if a pattern match was not simply
 	   		   random chance. */
@@ -414,6 +910,16 @@ int checkMemoryAccess(void *mem, int accessSize){
 					return 0;
 				}else{
 					check = checkRegistration(mem, accessSize);
+					if(useGuardPages == 0){
+						/* The shadow memory of guarded blocks is never registered, so the table decides instead. */
+						int guarded;
+						guarded = checkGuardedBlock(mem, accessSize);
+
+						if(guarded != -1){
+							check = guarded;
+						}
+					}
+
 					if(check == 1){
 						/* A red-zone was indeed accessed. */
 						return 1;
@@ -431,6 +937,16 @@ int checkMemoryAccess(void *mem, int accessSize){
 					return 0;
 				}else{
 					check = checkRegistration(mem, accessSize);
+					if(useGuardPages == 0){
+						/* The shadow memory of guarded blocks is never registered, so the table decides instead. */
+						int guarded;
+						guarded = checkGuardedBlock(mem, accessSize);
+
+						if(guarded != -1){
+							check = guarded;
+						}
+					}
+
 					if(check == 1){
 						/* A red-zone was indeed accessed. */
 						return 1;
@@ -446,6 +962,17 @@ int checkMemoryAccess(void *mem, int accessSize){
 			}
 		}else{
 			check = checkRegistration(mem, accessSize);
+			if(useGuardPages == 0){
+				/* The shadow memory of guarded blocks is never registered (and without fastCheckInit, their slack is not
+				   poisoned either), so the table decides instead. */
+				int guarded;
+				guarded = checkGuardedBlock(mem, accessSize);
+
+				if(guarded != -1){
+					check = guarded;
+				}
+			}
+
 			if(check == 1){
 				/* A red-zone was indeed accessed. */
 				return 1;
@@ -481,6 +1008,47 @@ int checkMemoryAccess(void *mem, int accessSize){
 	return -1;
 }
 
+int checkMemoryRange(void *mem, size_t size){
+	/* Returns a negative integer if the address was invalid, 0 if no byte of the range lies in a red-zone, and a positive
+	   integer otherwise. */
+	if(init == 0){
+		if(initLib() == 1){
+			printf("ERROR: INITIALISATION OF LIBRARY FAILED.\n");
+			return -1;
+		}
+	}
+
+	if(mem == NULL){
+		return -1;
+	}
+
+	if(useRegistration == 1){
+		/* In this mode, the pattern is the only detection mechanism, so any byte of it in the range is reported. */
+		if(size != 0 && memchr(mem, redzone, size) != NULL){
+			return 1;
+		}
+
+		return 0;
+	}
+
+	/* The range is checked as one (vector) access, covering the shadow memory of all of its granules. */
+	for(size_t offset = 0; offset < size; offset += RANGE_PART){
+		size_t part;
+		part = size - offset;
+		if(part > RANGE_PART){
+			part = RANGE_PART;
+		}
+
+		int check;
+		check = checkMemoryAccess(mem + offset, (int) part);
+		if(check != 0){
+			return check;
+		}
+	}
+
+	return 0;
+}
+
 int removeAddr(void *memL, void *memR){
 	/* Re-set the values of the shadow memory corresponding to the freed memory. */
 	void *shadowAddr;
@@ -580,6 +1148,17 @@ int registerAddr(void *memL, void *memR){
 	size_t toWriteAM;
 	toWriteAM = (sz - sz_rem) / 8;
 
+	if(useHugeShadow == 0){
+		/* Commit the shadow memory of the entire allocation in bulk, before it is written below. */
+		if(prefaultShadowMemory(shadowAddrL, (shadowAddrR - shadowAddrL) + toWriteRZ) == 1){
+			return 1;
+		}
+	}
+
+	if(shadowAccounting == 0){
+		markShadowChunks(shadowAddrL, (shadowAddrR - shadowAddrL) + toWriteRZ);
+	}
+
 	/* Write the shadow memory of the left red-zone. */
 	if(memset((unsigned char*) shadowAddrL, (unsigned char) 0xFF, toWriteRZ) == NULL){
 		return 1;
@@ -680,6 +1259,10 @@ memSeg *createBlock(void *start, size_t originalsz){
 	new->startAddrL = start - rz_sz;
 	new->startAddrR = start + originalsz;
 
+	if(shadowAccounting == 0){
+		__atomic_fetch_add(&metadataBytes, sizeof(struct memSeg), __ATOMIC_RELAXED);
+	}
+
 	return new;
 }
 
@@ -715,6 +1298,10 @@ int returnBlockToFreeList(void *mem, int startAdd){
 
 	memoryArray[index].counter++;
 
+	if(shadowAccounting == 0){
+		__atomic_fetch_add(&freeListBytes, allocation_sz, __ATOMIC_RELAXED);
+	}
+
 	if(startAdd == 0){
 		if(removeAddr(new->startAddrL, new->startAddrR) == 1){
 			free(new);
@@ -770,6 +1357,11 @@ void *getBlockFromFreeList(size_t sz){
 		return NULL;
 	}
 
+	if(shadowAccounting == 0){
+		__atomic_fetch_sub(&freeListBytes, toReturn->allocsz, __ATOMIC_RELAXED);
+		__atomic_fetch_sub(&metadataBytes, sizeof(struct memSeg), __ATOMIC_RELAXED);
+	}
+
 	/* Free the data structure used to keep track of the entry in the free-list, since it will now be in-use. */
 	free(toReturn);
 
@@ -870,6 +1462,18 @@ int allocateFreeList(size_t sz){
 		return 1;
 	}
 
+	if(useHugeShadow == 0){
+		/* The arena grows, so pre-fault the shadow memory of the entire new block at once. */
+		if(prefaultShadowMemory(getShadowMemoryAddress(blockStart), (newsz / 8) + 1) == 1){
+			return 1;
+		}
+	}
+
+	if(shadowAccounting == 0){
+		/* The red-zones of the free-list blocks are shared between neighbours, and stay in place for the lifetime of the block. */
+		__atomic_fetch_add(&redzoneBytes, rz_sz * (standardPreAllocSize + 1), __ATOMIC_RELAXED);
+	}
+
 	/* Ready the free-list for actual use. */
 	if(setFreeList(blockStart, index, sz) == 1){
 		return 1;
@@ -879,6 +1483,249 @@ int allocateFreeList(size_t sz){
 }
 /*--------------------------------*/
 
+/*----------------Guard Page Functions----------------*/
+int inGuardedRange(void *mem){
+	/* Returns 1 if mem may lie in a guarded block. Read without holding the guardedLock, so that frees and checks of other
+	   memory do not serialise on it: while a block is registered, it stays within [guardedLow, guardedHigh), since the
+	   range only changes with the first or last block. A block of the caller is therefore never missed. The values are
+	   written under the lock, so relaxed atomic loads suffice for this filter. */
+	if(__atomic_load_n(&guardedBlockCount, __ATOMIC_RELAXED) == 0){
+		return 0;
+	}
+
+	if((unsigned long long int) mem < __atomic_load_n(&guardedLow, __ATOMIC_RELAXED) || (unsigned long long int) mem >= __atomic_load_n(&guardedHigh, __ATOMIC_RELAXED)){
+		return 0;
+	}
+
+	return 1;
+}
+
+int getGuardedBlock(void *mem){
+	/* Returns the index of the guarded block whose mapping contains mem, or -1 if there is none. The caller must hold
+	   the guardedLock. */
+	if(guardedBlockCount == 0 || (unsigned long long int) mem < guardedLow || (unsigned long long int) mem >= guardedHigh){
+		return -1;
+	}
+
+	/* Binary search for the last block with a mapping starting at (or before) mem. */
+	size_t low;
+	low = 0;
+
+	size_t high;
+	high = guardedBlockCount;
+
+	while(low < high){
+		size_t middle;
+		middle = (low + high) / 2;
+
+		if(guardedBlocks[middle].mapStart <= mem){
+			low = middle + 1;
+		}else{
+			high = middle;
+		}
+	}
+
+	if(low == 0){
+		return -1;
+	}
+
+	if(mem >= guardedBlocks[low - 1].mapStart + guardedBlocks[low - 1].mapLength){
+		return -1;
+	}
+
+	return (int) (low - 1);
+}
+
+size_t getGuardedBlockSize(void *mem){
+	/* Returns the size of the guarded block starting at mem, or 0 if mem is not the start of a guarded block. */
+	size_t sz;
+	sz = 0;
+
+	if(inGuardedRange(mem) == 0){
+		return 0;
+	}
+
+	pthread_mutex_lock(&guardedLock);
+
+	int index;
+	index = getGuardedBlock(mem);
+
+	if(index != -1 && guardedBlocks[index].start == mem){
+		sz = guardedBlocks[index].size;
+	}
+
+	pthread_mutex_unlock(&guardedLock);
+
+	return sz;
+}
+
+int checkGuardedBlock(void *mem, int accessSize){
+	/* Returns -1 if mem does not lie in a guarded block, 0 if the access lies within the payload of one, and 1 if the
+	   access touches the slack around the payload. */
+	int check;
+	check = -1;
+
+	if(inGuardedRange(mem) == 0){
+		return -1;
+	}
+
+	pthread_mutex_lock(&guardedLock);
+
+	int index;
+	index = getGuardedBlock(mem);
+
+	if(index != -1){
+		if(mem >= guardedBlocks[index].start && (mem + accessSize) <= (guardedBlocks[index].start + guardedBlocks[index].size)){
+			check = 0;
+		}else{
+			check = 1;
+		}
+	}
+
+	pthread_mutex_unlock(&guardedLock);
+
+	return check;
+}
+
+int insertGuardedBlock(void *mem, size_t sz, void *mapStart, size_t mapLength){
+	/* The caller must hold the guardedLock. */
+	if(guardedBlockCount == guardedBlockCapacity){
+		size_t capacity;
+		capacity = guardedBlockCapacity * 2;
+		if(capacity == 0){
+			capacity = 64;
+		}
+
+		guardedBlock *blocks;
+		blocks = (guardedBlock*) realloc(guardedBlocks, capacity * sizeof(struct guardedBlock));
+		if(blocks == NULL){
+			return 1;
+		}
+
+		guardedBlocks = blocks;
+		guardedBlockCapacity = capacity;
+	}
+
+	/* Keep the table sorted. New mappings are usually placed below the previous ones, so search from the front. */
+	size_t index;
+	index = 0;
+
+	while(index < guardedBlockCount && guardedBlocks[index].mapStart < mapStart){
+		index++;
+	}
+
+	memmove(&guardedBlocks[index + 1], &guardedBlocks[index], (guardedBlockCount - index) * sizeof(struct guardedBlock));
+
+	guardedBlocks[index].start = mem;
+	guardedBlocks[index].size = sz;
+	guardedBlocks[index].mapStart = mapStart;
+	guardedBlocks[index].mapLength = mapLength;
+
+	__atomic_store_n(&guardedBlockCount, guardedBlockCount + 1, __ATOMIC_RELAXED);
+
+	__atomic_store_n(&guardedLow, (unsigned long long int) guardedBlocks[0].mapStart, __ATOMIC_RELAXED);
+	__atomic_store_n(&guardedHigh, (unsigned long long int) (guardedBlocks[guardedBlockCount - 1].mapStart + guardedBlocks[guardedBlockCount - 1].mapLength), __ATOMIC_RELAXED);
+
+	return 0;
+}
+
+void *allocateGuardedBlock(size_t sz){
+	/* The payload is rounded up to 16 bytes, to keep the alignment guarantees of malloc(). */
+	size_t payload;
+	payload = (sz + 15) & ~((size_t) 15);
+
+	size_t body;
+	body = (payload + pagesz - 1) & ~((size_t) pagesz - 1);
+
+	size_t front;
+	front = 0;
+
+	if(useLeftGuardPage == 0){
+		front = pagesz;
+	}
+
+	size_t length;
+	length = front + body + pagesz;
+
+	void *mapStart;
+	mapStart = mmap(NULL, length, (PROT_READ | PROT_WRITE), (MAP_PRIVATE | MAP_ANONYMOUS), -1, 0);
+	if(mapStart == MAP_FAILED){
+		return NULL;
+	}
+
+	void *guard;
+	guard = mapStart + front + body;
+
+	if(mprotect(guard, pagesz, PROT_NONE) == -1 || (front != 0 && mprotect(mapStart, pagesz, PROT_NONE) == -1)){
+		munmap(mapStart, length);
+		return NULL;
+	}
+
+	void *mem;
+	mem = guard - payload;
+
+	if(fastCheckInit == 0 && payload != sz){
+		/* Poison the slack between the end of the object and the guard page, which the hardware cannot catch. */
+		memset(mem + sz, redzone, payload - sz);
+	}
+
+	pthread_mutex_lock(&guardedLock);
+
+	if(insertGuardedBlock(mem, sz, mapStart, length) == 1){
+		pthread_mutex_unlock(&guardedLock);
+		munmap(mapStart, length);
+		return NULL;
+	}
+
+	pthread_mutex_unlock(&guardedLock);
+
+	return mem;
+}
+
+int freeGuardedBlock(void *mem){
+	/* Returns 0 if mem was a guarded block (which is now unmapped), and 1 otherwise. */
+	if(inGuardedRange(mem) == 0){
+		return 1;
+	}
+
+	pthread_mutex_lock(&guardedLock);
+
+	int index;
+	index = getGuardedBlock(mem);
+
+	if(index == -1 || guardedBlocks[index].start != mem){
+		pthread_mutex_unlock(&guardedLock);
+		return 1;
+	}
+
+	void *mapStart;
+	mapStart = guardedBlocks[index].mapStart;
+
+	size_t mapLength;
+	mapLength = guardedBlocks[index].mapLength;
+
+	memmove(&guardedBlocks[index], &guardedBlocks[index + 1], (guardedBlockCount - index - 1) * sizeof(struct guardedBlock));
+	__atomic_store_n(&guardedBlockCount, guardedBlockCount - 1, __ATOMIC_RELAXED);
+
+	if(guardedBlockCount == 0){
+		__atomic_store_n(&guardedLow, 0, __ATOMIC_RELAXED);
+		__atomic_store_n(&guardedHigh, 0, __ATOMIC_RELAXED);
+	}else{
+		__atomic_store_n(&guardedLow, (unsigned long long int) guardedBlocks[0].mapStart, __ATOMIC_RELAXED);
+		__atomic_store_n(&guardedHigh, (unsigned long long int) (guardedBlocks[guardedBlockCount - 1].mapStart + guardedBlocks[guardedBlockCount - 1].mapLength), __ATOMIC_RELAXED);
+	}
+
+	pthread_mutex_unlock(&guardedLock);
+
+	/* Unmapped after the removal from the table, so no other thread can find a mapping that is already gone. */
+	if(munmap(mapStart, mapLength) == -1){
+		printf("ERROR: FAILED TO UNMAP GUARDED BLOCK.\n");
+	}
+
+	return 0;
+}
+/*------------------------------*/
+
 /* This function assumes alignment is in order when freeing memory. */
 void Dlib_free(void *mem){
 	if(init == 0){
@@ -919,9 +1766,18 @@ void Dlib_free(void *mem){
 	//		return;
 	//	}
 	}else{
+		if(useGuardPages == 0 && freeGuardedBlock(mem) == 0){
+			/* A guarded block, which has no red-zones and no registration. */
+			return;
+		}
+
 		/* Return the pointer to the actual start of the contiguous memory region. */
 		mem = mem - rz_sz;
 
+		if(shadowAccounting == 0){
+			__atomic_fetch_sub(&redzoneBytes, 2 * rz_sz, __ATOMIC_RELAXED);
+		}
+
 		/* Remove the red-zones and object memory region from the shadow memory. The right red-zone in this case is
 	  	   not useful, but only exists for compatibility purposes. */
 		if(removeAddr(mem, NULL) == 1){
@@ -1009,6 +1865,10 @@ void *Dlib_malloc(size_t sz){
 
 		return toReturn;
 	}else{
+		if(useGuardPages == 0 && sz >= guardPageThreshold){
+			return allocateGuardedBlock(sz);
+		}
+
 		size_t ac_sz;
 		ac_sz = sz + (2 * rz_sz);
 
@@ -1043,6 +1903,10 @@ void *Dlib_malloc(size_t sz){
 			}
 		}
 
+		if(shadowAccounting == 0){
+			__atomic_fetch_add(&redzoneBytes, 2 * rz_sz, __ATOMIC_RELAXED);
+		}
+
 		/* Re-align pointer to the address where the actual application memory starts. */
 		mem = mem + rz_sz;
 
@@ -1102,7 +1966,13 @@ void *Dlib_realloc(void *mem, size_t nsz){
 			getsz--;
 			oldsz = *getsz;
 		}else{
-			oldsz = malloc_usable_size(mem);
+			if(useGuardPages == 0){
+				oldsz = getGuardedBlockSize(mem + rz_sz);
+			}
+
+			if(oldsz == 0){
+				oldsz = malloc_usable_size(mem);
+			}
 		}
 
 		if(oldsz == 0){
@@ -1211,6 +2081,10 @@ void *Dlib_memalign(size_t alignment, size_t sz){
 		}
 	}
 
+	if(shadowAccounting == 0){
+		__atomic_fetch_add(&redzoneBytes, 2 * rz_sz, __ATOMIC_RELAXED);
+	}
+
 	/* Re-align pointer to the address where the actual application memory starts. */
 	mem = mem + rz_sz;
 
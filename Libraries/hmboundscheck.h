@@ -19,6 +19,23 @@ typedef struct freeList{
 	size_t size;
 }freeList;
 
+typedef struct guardedBlock{
+	void *start;
+	size_t size;
+
+	void *mapStart;
+	size_t mapLength;
+}guardedBlock;
+
+//Memory accounting of the library, broken down by source (all values in bytes, except for the pre-faulted chunks).
+typedef struct shadowStats{
+	size_t shadowCommitted;
+	size_t shadowPrefaultedChunks;
+	size_t redzone;
+	size_t freeListCached;
+	size_t metadata;
+}shadowStats;
+
 //Essential values for shadow memory management, including the starting address of the shadow memory.
 extern void *shadowMemStart;
 
@@ -29,6 +46,12 @@ extern size_t scale;
 //in any alignment issues for the red-zone pattern (unlike the 8-byte pattern).
 extern unsigned char redzone;
 
+//The sample rate of the check sites instrumented with -hm-sample-checks.
+extern int __hmbounds_sample_rate;
+
+//Whether the checks of a program instrumented with -hm-clone-unchecked are enabled for the current thread.
+extern __thread int __hmbounds_checks_enabled;
+
 /*----------------Initialisation Functions----------------*/
 //Unmap the shadow memory whenever necessary for security/program safety reasons.
 int unmapShadowMemory();
@@ -36,6 +59,30 @@ int unmapShadowMemory();
 //Set up the shadow memory for the run-time library.
 int initShadowMemory();
 
+//Commit a range of the shadow memory in one go, instead of page by page on first touch.
+int populateShadowMemory(void *start, size_t len);
+
+//Pre-fault the (huge page sized) shadow chunks covering a range of the shadow memory, if not done before.
+int prefaultShadowMemory(void *shadowAddr, size_t sz);
+
+//Fork handlers (pthread_atfork), holding the guardedLock across fork(), and resetting the pre-fault windows in the child
+//of a wiped shadow memory (the fork-aware mode).
+void prepareFork();
+void parentFork();
+void childFork();
+
+//Mark the shadow chunks covering a range of the shadow memory as written, for the memory accounting.
+void markShadowChunks(void *shadowAddr, size_t sz);
+
+//Amount of shadow memory actually committed (resident), measured with mincore() over the written shadow chunks.
+size_t getCommittedShadowMemory();
+
+//Fill in the memory accounting of the library.
+int getShadowMemoryStats(shadowStats *stats);
+
+//Print the memory accounting to stderr as [setup-report] keys (the format of the benchmark-utils reports).
+void reportShadowMemory();
+
 //Calculates the size of the red-zone. Should be done once at startup, result saved in a constant.
 size_t calcRZSize(size_t sz);
 
@@ -65,9 +112,19 @@ void *getShadowMemoryAddress(void *mem);
 //accesses are supported).
 int checkRegistration(void *mem, int accessSize);
 
+//Returns 1 if any of the given amount of shadow bytes is non-zero, testing them as 64-, 32- and 16-bit words.
+int checkShadowWord(unsigned char *shadowAddr, size_t count);
+
+//Check the shadow memory of every granule covered by an access of more than 8 bytes (e.g., a 16-, 32- or 64-byte vector
+//access), instead of only its first and last byte.
+int checkRegistrationVector(void *mem, int accessSize);
+
 //Check if the selected memory (for access) is addressable through a 'fast' check, and otherwise opt for a 'slow' check.
 int checkMemoryAccess(void *mem, int accessSize);
 
+//Check if any byte of a range lies in a red-zone, used for all accesses of a loop at once (checked before the loop).
+int checkMemoryRange(void *mem, size_t size);
+
 //A method to reverse all bits in the shadow memory to a not-in-use state.
 int removeAddr(void *memL, void *memR);
 
@@ -103,6 +160,29 @@ int setFreeList(void *blockStart, int index, size_t sz);
 int allocateFreeList(size_t sz);
 /*--------------------------------*/
 
+/*----------------Guard Page Functions----------------*/
+//Whether an address may lie in a guarded block, tested without taking the lock of the guarded blocks.
+int inGuardedRange(void *mem);
+
+//Find the guarded block whose mapping contains an address. Returns its index in the table, or -1.
+int getGuardedBlock(void *mem);
+
+//Returns the size of the guarded block starting at an address, or 0 if it is not the start of a guarded block.
+size_t getGuardedBlockSize(void *mem);
+
+//Check an access against the guarded blocks: -1 if outside of all of them, 0 if within a payload, 1 if it touches the slack.
+int checkGuardedBlock(void *mem, int accessSize);
+
+//Add a guarded block to the (sorted) table of guarded blocks.
+int insertGuardedBlock(void *mem, size_t sz, void *mapStart, size_t mapLength);
+
+//Serve a large allocation from its own mapping, right-aligned against a guard page.
+void *allocateGuardedBlock(size_t sz);
+
+//Unmap a guarded block. Returns 1 if the address is not the start of a guarded block.
+int freeGuardedBlock(void *mem);
+/*--------------------------------*/
+
 //Wrapped free. Initiates the additional deallocation checks.
 void Dlib_free(void *mem);
 
@@ -0,0 +1,23 @@
+#ifndef _HMPROFILE_H_
+#define _HMPROFILE_H_
+
+//Amount of check sites of which the executions can be counted. Must be a power of two.
+#define PROFILE_SITES 65536
+
+//Amount of slots of the table probed for a site, before its executions are no longer counted.
+#define PROFILE_PROBES 64
+
+typedef struct siteCounter{
+	unsigned long int site;
+	unsigned long int count;
+}siteCounter;
+
+/*----------------Profile Functions----------------*/
+//Count an execution of a check site, called by programs instrumented with -hm-profile-gen.
+void countCheckSite(unsigned long int site);
+
+//Write the execution counts of all check sites to the profile, on exit.
+void writeProfile();
+/*--------------------------------*/
+
+#endif
@@ -0,0 +1,111 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+
+/* A test for the unchecked clones of the pass (-hm-clone-unchecked). Build it with the pass and the flag, and link it
+   against the runtime. Every function is dispatched to its checked or its unchecked version at run-time, depending on
+   __hmbounds_checks_enabled. The functions below take and return structs of more than 16 bytes by value, which are
+   passed in memory (byval/sret), so the call to the clone has to agree with it on the attributes of the parameters. */
+
+#define FIELDS 8
+
+extern __thread int __hmbounds_checks_enabled;
+
+typedef struct largeStruct{
+	long int fields[FIELDS];
+} largeStruct;
+
+__attribute__((noinline))
+long int sumStruct(largeStruct object, int *buffer){
+	/* The copy of the callee may be changed, without the struct of the caller changing. */
+	long int sum;
+	sum = 0;
+
+	for(int i = 0; i < FIELDS; i++){
+		sum = sum + object.fields[i] + buffer[i];
+		object.fields[i] = 0;
+	}
+
+	return sum;
+}
+
+__attribute__((noinline))
+largeStruct scaleStruct(largeStruct object, long int factor){
+	largeStruct result;
+
+	for(int i = 0; i < FIELDS; i++){
+		result.fields[i] = object.fields[i] * factor;
+	}
+
+	return result;
+}
+
+int testDispatch(int *buffer){
+	largeStruct object;
+	for(int i = 0; i < FIELDS; i++){
+		object.fields[i] = i + 1;
+	}
+
+	long int sum;
+	sum = sumStruct(object, buffer);
+	if(sum != 36 + FIELDS){
+		printf("INCORRECT: STRUCT PASSED BY VALUE WAS NOT RECEIVED CORRECTLY (SUM %ld).\n", sum);
+		return 1;
+	}
+
+	for(int i = 0; i < FIELDS; i++){
+		if(object.fields[i] != i + 1){
+			printf("INCORRECT: STRUCT PASSED BY VALUE WAS CHANGED BY THE CALLEE.\n");
+			return 1;
+		}
+	}
+
+	largeStruct scaled;
+	scaled = scaleStruct(object, 3);
+	for(int i = 0; i < FIELDS; i++){
+		if(scaled.fields[i] != (i + 1) * 3){
+			printf("INCORRECT: STRUCT RETURNED BY VALUE WAS NOT RECEIVED CORRECTLY.\n");
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+int main(int argc, char **argv){
+	int *buffer;
+	buffer = malloc(FIELDS * sizeof(int));
+	if(buffer == NULL){
+		return 1;
+	}
+
+	for(int i = 0; i < FIELDS; i++){
+		buffer[i] = 1;
+	}
+
+	int result;
+	result = 0;
+
+	printf("Test 0: DISPATCH TO THE CHECKED FUNCTIONS\n");
+	if(testDispatch(buffer) == 0){
+		printf("Test 0: COMPLETED.\n");
+	}else{
+		printf("Test 0: FAILED.\n");
+		result = 1;
+	}
+
+	printf("Test 1: DISPATCH TO THE UNCHECKED FUNCTIONS\n");
+	__hmbounds_checks_enabled = 0;
+	if(testDispatch(buffer) == 0){
+		printf("Test 1: COMPLETED.\n");
+	}else{
+		printf("Test 1: FAILED.\n");
+		result = 1;
+	}
+	__hmbounds_checks_enabled = 1;
+
+	free(buffer);
+
+	return result;
+}
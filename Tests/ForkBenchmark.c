@@ -0,0 +1,134 @@
+#include "DlibComplete.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+/* A benchmark for pre-fork server workloads: the heap is warmed up first, after which a number of worker processes
+   is forked. The fork() latency (in the parent), and the minor page faults taken by every worker during its first
+   frees and allocations, are reported. Build and run it once with useForkShadow disabled and once with it enabled
+   (and with either of the forkShadowMode values) to compare. */
+
+#define WARM_OBJECTS 200000
+#define WARM_SIZE 64
+#define WORKERS 16
+#define WORKER_OPERATIONS 20000
+
+static char *objects[WARM_OBJECTS];
+
+double getTime(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (ts.tv_sec * 1000000.0) + (ts.tv_nsec / 1000.0);
+}
+
+long getMinorFaults(){
+	struct rusage u;
+	if(getrusage(RUSAGE_SELF, &u) < 0){
+		return -1;
+	}
+
+	return u.ru_minflt;
+}
+
+int warmHeap(){
+	for(int i = 0; i < WARM_OBJECTS; i++){
+		objects[i] = Dlib_malloc(WARM_SIZE + (i % 8) * 8);
+		if(objects[i] == NULL){
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+int worker(int pipefd){
+	long faults;
+	faults = getMinorFaults();
+
+	/* Free some of the inherited objects, and allocate new ones in their place, like a worker serving requests. */
+	for(int i = 0; i < WORKER_OPERATIONS; i++){
+		int index;
+		index = (i * 7919) % WARM_OBJECTS;
+
+		Dlib_free(objects[index]);
+
+		objects[index] = Dlib_malloc(WARM_SIZE);
+		if(objects[index] == NULL){
+			return 1;
+		}
+
+		checkMemoryAccess(objects[index], 8);
+	}
+
+	faults = getMinorFaults() - faults;
+
+	if(write(pipefd, &faults, sizeof(faults)) != sizeof(faults)){
+		return 1;
+	}
+
+	return 0;
+}
+
+int main(int argc, char **argv){
+	int pipefd[2];
+
+	if(warmHeap() == 1){
+		printf("ERROR: FAILED TO WARM UP THE HEAP.\n");
+		return 1;
+	}
+
+	double forkTime;
+	forkTime = 0;
+
+	long faults;
+	faults = 0;
+
+	long totalFaults;
+	totalFaults = 0;
+
+	for(int i = 0; i < WORKERS; i++){
+		/* One pipe per worker, so the parent can close the write end and a dead worker makes the read fail. */
+		if(pipe(pipefd) == -1){
+			return 1;
+		}
+
+		double start;
+		start = getTime();
+
+		pid_t pid;
+		pid = fork();
+
+		if(pid == 0){
+			close(pipefd[0]);
+			_exit(worker(pipefd[1]));
+		}else if(pid == -1){
+			printf("ERROR: FORK FAILED.\n");
+			return 1;
+		}
+
+		forkTime = forkTime + (getTime() - start);
+		close(pipefd[1]);
+
+		if(read(pipefd[0], &faults, sizeof(faults)) != sizeof(faults)){
+			printf("ERROR: WORKER FAILED.\n");
+			return 1;
+		}
+
+		close(pipefd[0]);
+
+		totalFaults = totalFaults + faults;
+		waitpid(pid, NULL, 0);
+	}
+
+	printf("Fork latency (average): %.1f us\n", forkTime / WORKERS);
+	printf("Worker minor faults (average): %ld\n", totalFaults / WORKERS);
+
+	return 0;
+}
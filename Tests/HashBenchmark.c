@@ -0,0 +1,171 @@
+#include "DlibHash.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <time.h>
+
+/* A benchmark for the hash functions of the hash table, at several granularities. The red-zone addresses of a number of
+   allocation patterns are mapped to the buckets of a table sized like the library would (HASH_MAX_LOAD objects per bucket),
+   and a histogram of the bucket loads is reported, together with the average bucket size seen by a lookup (which the
+   'slow' check pays for), and the time per hash. The default hash function of the library is chosen from its results. */
+
+#define OBJECTS 200000
+#define RZ_SIZE 128
+#define PATTERNS 5
+#define HISTOGRAM 8
+
+static unsigned long int *loads;
+
+double getTime(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (ts.tv_sec * 1000000000.0) + ts.tv_nsec;
+}
+
+void getObject(int pattern, int i, char **objects, unsigned long int *addr, unsigned long int *size){
+	/* Objects from malloc(), objects at a regular stride in an arena (as slab and pool allocators place them), and
+	   large (page aligned) objects. */
+	unsigned long int base;
+	base = 0x7f0000000000UL;
+
+	if(pattern == 0){
+		*size = 16 + (i % 32) * 16;
+		*addr = (unsigned long int) objects[i];
+	}else if(pattern == 1){
+		*size = 48;
+		*addr = base + (unsigned long int) i * 64;
+	}else if(pattern == 2){
+		*size = 4096 - (2 * RZ_SIZE);
+		*addr = base + (unsigned long int) i * 4096;
+	}else if(pattern == 3){
+		*size = 512;
+		*addr = base + (unsigned long int) i * 65536;
+	}else{
+		*size = 1048576;
+		*addr = base + (unsigned long int) i * (2097152 + 4096);
+	}
+}
+
+void runBenchmark(int pattern, unsigned long int exponent, int function, char **objects){
+	unsigned long int tableSize;
+	tableSize = HASHSZ;
+
+	while(tableSize * HASH_MAX_LOAD < OBJECTS){
+		tableSize = tableSize * 2;
+	}
+
+	memset(loads, 0, tableSize * sizeof(unsigned long int));
+
+	unsigned long int entries;
+	entries = 0;
+
+	double start;
+	start = getTime();
+
+	for(int i = 0; i < OBJECTS; i++){
+		unsigned long int addr;
+		unsigned long int size;
+		getObject(pattern, i, objects, &addr, &size);
+
+		/* An object is registered in the bucket of the page of both of its red-zones. */
+		unsigned long int pageL;
+		pageL = addr >> exponent;
+
+		unsigned long int pageR;
+		pageR = (addr + RZ_SIZE + size) >> exponent;
+
+		loads[hashPage(pageL, function) & (tableSize - 1)]++;
+		entries++;
+
+		if(pageR != pageL){
+			loads[hashPage(pageR, function) & (tableSize - 1)]++;
+			entries++;
+		}
+	}
+
+	double time;
+	time = (getTime() - start) / entries;
+
+	unsigned long int histogram[HISTOGRAM];
+	memset(histogram, 0, sizeof(histogram));
+
+	unsigned long int maxLoad;
+	maxLoad = 0;
+
+	double probes;
+	probes = 0;
+
+	for(unsigned long int i = 0; i < tableSize; i++){
+		/* Loads of 0, 1-7, 8-15, 16-31, ..., up to 256 and more. */
+		int bin;
+		bin = 0;
+
+		if(loads[i] != 0){
+			bin = 1;
+			while(bin < HISTOGRAM - 1 && loads[i] >= (8UL << (bin - 1))){
+				bin++;
+			}
+		}
+
+		histogram[bin]++;
+
+		if(loads[i] > maxLoad){
+			maxLoad = loads[i];
+		}
+
+		probes = probes + ((double) loads[i] * loads[i]);
+	}
+
+	const char *names[3] = {"xor-fold", "fibonacci", "crc32c"};
+
+	printf("%-9s %6lu ", names[function], 1UL << exponent);
+
+	for(int i = 0; i < HISTOGRAM; i++){
+		printf("%7lu ", histogram[i]);
+	}
+
+	printf("%7lu %8.1f %6.1f\n", maxLoad, probes / entries, time);
+}
+
+int main(int argc, char **argv){
+	const char *patterns[PATTERNS] = {"malloc, 16-512 bytes", "arena, 64 byte stride", "arena, 4KB stride", "arena, 64KB stride",
+		"large, 1MB"};
+
+	unsigned long int exponents[4] = {8, 10, 12, 16};
+
+	char **objects;
+	objects = malloc(OBJECTS * sizeof(char*));
+	if(objects == NULL){
+		return 1;
+	}
+
+	for(int i = 0; i < OBJECTS; i++){
+		objects[i] = malloc(16 + (i % 32) * 16 + (2 * RZ_SIZE));
+		if(objects[i] == NULL){
+			return 1;
+		}
+	}
+
+	loads = malloc((OBJECTS / HASH_MAX_LOAD + HASHSZ) * 2 * sizeof(unsigned long int));
+	if(loads == NULL){
+		return 1;
+	}
+
+	for(int pattern = 0; pattern < PATTERNS; pattern++){
+		printf("Pattern: %s\n", patterns[pattern]);
+		printf("%-9s %6s %7s %7s %7s %7s %7s %7s %7s %7s %7s %8s %6s\n", "hash", "page", "0", "1-7", "8-15", "16-31", "32-63",
+			"64-127", "128-255", ">=256", "max", "probes", "ns");
+
+		for(int i = 0; i < 4; i++){
+			for(int function = HASH_XOR_FOLD; function <= HASH_CRC32C; function++){
+				runBenchmark(pattern, exponents[i], function, objects);
+			}
+		}
+
+		printf("\n");
+	}
+
+	return 0;
+}
@@ -9,6 +9,328 @@
 
 /* A simple program for multiple tests to be launched.*/
 
+int test27(){
+	/* Deferred removals are applied in batches, sorted on their lock. Once a batch is applied, none of the red-zones of its
+	   objects may still be registered, while those of the other objects must be. The batch is applied directly here (as
+	   flushRemovalLog() does), so that all objects can still be checked afterwards. */
+	size_t amount = REMOVAL_LOG_SIZE;
+	size_t sz = 100;
+	size_t rz = (size_t)1 << scale;
+
+	int result;
+	result = 0;
+
+	char *objects[REMOVAL_LOG_SIZE * 2];
+	for(size_t i = 0; i < amount * 2; i++){
+		objects[i] = Dlib_malloc(sz);
+		if(objects[i] == NULL){
+			return 1;
+		}
+	}
+
+	rzAddr batch[REMOVAL_LOG_SIZE];
+	for(size_t i = 0; i < amount; i++){
+		batch[i].startAddrL = objects[i * 2] - rz;
+		batch[i].startAddrR = NULL;
+	}
+
+	if(removeAddrs(batch, amount) != 0){
+		printf("INCORRECT: BATCH OF REMOVALS FAILED.\n");
+		result = 1;
+	}
+
+	for(size_t i = 0; i < amount * 2; i++){
+		int expected;
+		expected = i % 2;
+
+		if(checkAddrInList(objects[i] - 1) != expected || checkAddrInList(objects[i] + sz) != expected){
+			printf("INCORRECT: BATCH OF REMOVALS REMOVED THE WRONG RED-ZONES.\n");
+			result = 1;
+			break;
+		}
+	}
+
+	for(size_t i = 0; i < amount * 2; i++){
+		if(i % 2 == 0){
+			free(objects[i] - rz);
+		}else{
+			Dlib_free(objects[i]);
+		}
+	}
+
+	/* Deallocations (logged, if deferred removals are enabled) must all be applied once the log of the thread is flushed,
+	   however many batches they span. */
+	size_t logged = REMOVAL_LOG_SIZE * 3 + 5;
+
+	unsigned long int freed[REMOVAL_LOG_SIZE * 3 + 5];
+	for(size_t i = 0; i < logged; i++){
+		char *object;
+		object = Dlib_malloc(sz);
+		if(object == NULL){
+			return 1;
+		}
+
+		freed[i] = (unsigned long int) object;
+		Dlib_free(object);
+	}
+
+	flushRemovalLog();
+
+	for(size_t i = 0; i < logged; i++){
+		if(checkAddrInList((void*) (freed[i] - 1)) != 0 || checkAddrInList((void*) (freed[i] + sz)) != 0){
+			printf("INCORRECT: FREED OBJECT STILL REGISTERED AFTER FLUSHING THE REMOVAL LOG.\n");
+			result = 1;
+			break;
+		}
+	}
+
+	return result;
+}
+
+int test26(){
+	/* A range check covers all accesses of a loop at once: it must accept the whole object (even if its data holds the
+	   red-zone pattern), and detect ranges reaching into either red-zone. */
+	size_t sz = 1000;
+
+	char *buffer;
+	buffer = Dlib_malloc(sz);
+	if(buffer == NULL){
+		return 1;
+	}
+
+	int result;
+	result = 0;
+
+	memset(buffer, 0, sz);
+	if(checkMemoryRange(buffer, sz) != 0){
+		printf("INCORRECT: IN-BOUNDS RANGE DETECTED AS OUT-OF-BOUNDS.\n");
+		result = 1;
+	}
+
+	memset(buffer, redzone, sz);
+	if(checkMemoryRange(buffer, sz) != 0){
+		printf("INCORRECT: IN-BOUNDS RANGE DETECTED AS OUT-OF-BOUNDS.\n");
+		result = 1;
+	}
+
+	if(checkMemoryRange(buffer, sz + 1) != 1 || checkMemoryRange(buffer + 500, sz) != 1){
+		printf("INCORRECT: RANGE INTO THE RIGHT RED-ZONE DETECTED AS IN-BOUNDS.\n");
+		result = 1;
+	}
+
+	if(checkMemoryRange(buffer - 1, 8) != 1){
+		printf("INCORRECT: RANGE INTO THE LEFT RED-ZONE DETECTED AS IN-BOUNDS.\n");
+		result = 1;
+	}
+
+	Dlib_free(buffer);
+
+	return result;
+}
+
+int test25(){
+	/* Objects allocated (and registered) in a single batch must each be zeroed, in-bounds, and surrounded by red-zones. */
+	size_t amount = 500;
+	size_t sz = 100;
+	size_t rz = (size_t)1 << scale;
+
+	void **objects;
+	objects = Dlib_independent_calloc(amount, sz, NULL);
+	if(objects == NULL){
+		return 1;
+	}
+
+	int result;
+	result = 0;
+
+	for(size_t i = 0; i < amount; i++){
+		char *object;
+		object = objects[i];
+
+		for(size_t j = 0; j < sz; j++){
+			if(object[j] != 0){
+				printf("INCORRECT: OBJECT NOT ZEROED.\n");
+				result = 1;
+				break;
+			}
+		}
+
+		if(checkMemoryAccess(object, 1) != 0 || checkMemoryAccess(object + sz - 1, 1) != 0){
+			printf("INCORRECT: IN-BOUNDS DETECTED AS OUT-OF-BOUNDS.\n");
+			result = 1;
+		}
+
+		if(checkMemoryAccess(object - 1, 1) != 1 || checkMemoryAccess(object + sz, 1) != 1 ||
+			checkMemoryAccess(object + sz + rz - 1, 1) != 1){
+			printf("INCORRECT: OUT-OF-BOUNDS DETECTED AS IN-BOUNDS.\n");
+			result = 1;
+		}
+	}
+
+	for(size_t i = 0; i < amount; i++){
+		Dlib_free(objects[i]);
+	}
+
+	free(objects);
+
+	return result;
+}
+
+int test24(){
+	/* A freed object may be cached by an earlier 'slow' check, while its memory is reused by an object with a different
+	   layout. The cache must not answer for the new object. */
+	size_t sz = 1000;
+	size_t szb = 968;
+
+	char *buffer;
+	buffer = Dlib_malloc(sz);
+	if(buffer == NULL){
+		return 1;
+	}
+
+	memset(buffer, redzone, sz);
+
+	int result;
+	result = 0;
+
+	for(size_t i = sz - 64; i < sz; i++){
+		if(checkMemoryAccess(buffer + i, 1) != 0){
+			printf("INCORRECT: IN-BOUNDS DETECTED AS OUT-OF-BOUNDS.\n");
+			result = 1;
+		}
+	}
+
+	Dlib_free(buffer);
+
+	/* Normally placed where the first object was. */
+	char *bufferb;
+	bufferb = Dlib_malloc(szb);
+	if(bufferb == NULL){
+		return 1;
+	}
+
+	for(size_t i = szb; i < sz; i++){
+		if(checkMemoryAccess(bufferb + i, 1) != 1){
+			printf("INCORRECT: OUT-OF-BOUNDS DETECTED AS IN-BOUNDS.\n");
+			result = 1;
+			break;
+		}
+	}
+
+	Dlib_free(bufferb);
+
+	return result;
+}
+
+int test23(){
+	/* Object data holding the red-zone pattern passes the 'fast' check, so it must be cleared by the 'slow' check. Every
+	   byte of the red-zones must still be detected, including red-zones crossing into the next page. */
+	int amount = 1000;
+	size_t rz = (size_t) 1 << scale;
+
+	char **buffers;
+	buffers = malloc(amount * sizeof(char*));
+	if(buffers == NULL){
+		return 1;
+	}
+
+	for(int i = 0; i < amount; i++){
+		buffers[i] = Dlib_malloc(40 + (i % 13) * 24);
+		if(buffers[i] == NULL){
+			return 1;
+		}
+
+		memset(buffers[i], redzone, 40 + (i % 13) * 24);
+	}
+
+	int result;
+	result = 0;
+
+	for(int i = 0; i < amount; i++){
+		size_t sz = 40 + (i % 13) * 24;
+
+		for(size_t j = 0; j < sz; j++){
+			if(checkMemoryAccess(buffers[i] + j, 1) != 0){
+				printf("INCORRECT: IN-BOUNDS DETECTED AS OUT-OF-BOUNDS.\n");
+				result = 1;
+				break;
+			}
+		}
+
+		for(size_t j = 1; j <= rz; j++){
+			if(checkMemoryAccess(buffers[i] - j, 1) != 1 || checkMemoryAccess(buffers[i] + sz + j - 1, 1) != 1){
+				printf("INCORRECT: OUT-OF-BOUNDS DETECTED AS IN-BOUNDS.\n");
+				result = 1;
+				break;
+			}
+		}
+	}
+
+	for(int i = 0; i < amount; i++){
+		Dlib_free(buffers[i]);
+	}
+
+	free(buffers);
+
+	return result;
+}
+
+int test22(){
+	/* Register enough objects for the hash table to grow (several times), and check the red-zones both while and after
+	   the table is rehashed. Freeing them all afterwards shrinks the table again. */
+	int amount = 200000;
+	size_t sz = 16;
+
+	char **buffers;
+	buffers = malloc(amount * sizeof(char*));
+	if(buffers == NULL){
+		return 1;
+	}
+
+	for(int i = 0; i < amount; i++){
+		buffers[i] = Dlib_malloc(sz);
+		if(buffers[i] == NULL){
+			return 1;
+		}
+	}
+
+	int result;
+	result = 0;
+
+	for(int i = 0; i < amount; i = i + 997){
+		if(checkMemoryAccess(buffers[i], 8) != 0){
+			printf("INCORRECT: IN-BOUNDS DETECTED AS OUT-OF-BOUNDS.\n");
+			result = 1;
+		}
+
+		if(checkMemoryAccess(buffers[i] + sz, 1) != 1){
+			printf("INCORRECT: OUT-OF-BOUNDS DETECTED AS IN-BOUNDS.\n");
+			result = 1;
+		}
+	}
+
+	for(int i = 0; i < amount; i++){
+		Dlib_free(buffers[i]);
+	}
+
+	free(buffers);
+
+	char *buffer;
+	buffer = Dlib_malloc(sz);
+	if(buffer == NULL){
+		return 1;
+	}
+
+	if(checkMemoryAccess(buffer - 1, 1) != 1){
+		printf("INCORRECT: OUT-OF-BOUNDS DETECTED AS IN-BOUNDS.\n");
+		result = 1;
+	}
+
+	Dlib_free(buffer);
+
+	return result;
+}
+
 int test21(){
 	char *buffer, *bufferb, *bufferc;
 	size_t sz = 2048;
@@ -1564,5 +1886,49 @@ int main(int argc, char **argv){
 		printf("Test 21: FAILED.\n");
 	}
 
+	printf("\n");
+
+	printf("Test 22: HASH TABLE RESIZING TEST\n");
+	if(test22() == 0){
+		printf("Test 22: COMPLETED.\n");
+	}else{
+		printf("Test 22: FAILED.\n");
+	}
+
+	printf("Test 23: RED-ZONE PATTERN IN OBJECT DATA TEST\n");
+	if(test23() == 0){
+		printf("Test 23: COMPLETED.\n");
+	}else{
+		printf("Test 23: FAILED.\n");
+	}
+
+	printf("Test 24: CACHED OBJECT REUSE TEST\n");
+	if(test24() == 0){
+		printf("Test 24: COMPLETED.\n");
+	}else{
+		printf("Test 24: FAILED.\n");
+	}
+
+	printf("Test 25: BATCH REGISTRATION TEST\n");
+	if(test25() == 0){
+		printf("Test 25: COMPLETED.\n");
+	}else{
+		printf("Test 25: FAILED.\n");
+	}
+
+	printf("Test 26: RANGE CHECK TEST\n");
+	if(test26() == 0){
+		printf("Test 26: COMPLETED.\n");
+	}else{
+		printf("Test 26: FAILED.\n");
+	}
+
+	printf("Test 27: DEFERRED REMOVAL TEST\n");
+	if(test27() == 0){
+		printf("Test 27: COMPLETED.\n");
+	}else{
+		printf("Test 27: FAILED.\n");
+	}
+
 	return 0;
 }
\ No newline at end of file
@@ -9,6 +9,46 @@
 
 /* A simple program for multiple tests to be launched.*/
 
+int test21(){
+	char *buffer;
+	size_t sz = 68;
+
+	buffer = Dlib_malloc(sz);
+	if(buffer == NULL){
+		return 1;
+	}
+
+	if(checkMemoryAccess(buffer, 64) == 0 && checkMemoryAccess(buffer + 4, 64) == 0 && checkMemoryAccess(buffer + 36, 32) == 0
+		&& checkMemoryAccess(buffer + 52, 16) == 0){
+		printf("CORRECT: IN-BOUNDS VECTOR ACCESSES DETECTED.\n");
+	}else{
+		printf("INCORRECT: IN-BOUNDS VECTOR ACCESS DETECTED AS OUT-OF-BOUNDS.\n");
+		Dlib_free(buffer);
+		return 1;
+	}
+
+	if(checkMemoryAccess(buffer + 5, 64) == 1 && checkMemoryAccess(buffer + 40, 32) == 1 && checkMemoryAccess(buffer + 53, 16) == 1){
+		printf("CORRECT: OUT-OF-BOUNDS VECTOR ACCESSES DETECTED.\n");
+	}else{
+		printf("INCORRECT: OUT-OF-BOUNDS VECTOR ACCESS NOT DETECTED.\n");
+		Dlib_free(buffer);
+		return 1;
+	}
+
+	/* Starts in the left red-zone, and ends in the object. */
+	if(checkMemoryAccess(buffer - 8, 16) == 1){
+		printf("CORRECT: VECTOR ACCESS INTO RED-ZONE DETECTED.\n");
+	}else{
+		printf("INCORRECT: VECTOR ACCESS INTO RED-ZONE NOT DETECTED.\n");
+		Dlib_free(buffer);
+		return 1;
+	}
+
+	Dlib_free(buffer);
+
+	return 0;
+}
+
 int test20(){
 	char *buffer;
 	size_t sz = 16;
@@ -1710,5 +1750,14 @@ int main(int argc, char **argv){
 		printf("Test 20: FAILED.\n");
 	}
 
+	printf("\n");
+
+	printf("Test 21: VECTOR ACCESS SIZE TEST\n");
+	if(test21() == 0){
+		printf("Test 21: COMPLETED.\n");
+	}else{
+		printf("Test 21: FAILED.\n");
+	}
+
 	return 0;
 }
\ No newline at end of file
@@ -509,6 +509,13 @@ class SPEC2006(Target):
     # define benchmark sets, generated using scripts/parse-benchmarks-sets.py
     benchmarks = benchmark_sets
 
+    #: :class:`list` of memory usage keys reported by instance runtimes in
+    #: addition to the rusage keys, copied into the results when present
+    memory_breakdown_keys = [
+        'shadow_committed_bytes', 'shadow_prefaulted_chunks', 'redzone_bytes',
+        'freelist_cached_bytes', 'metadata_bytes'
+    ]
+
     def parse_outfile(self, ctx, instance_name, outfile):
         # called by self.butils.parse_logs() in report() below
 
@@ -560,15 +567,20 @@ class SPEC2006(Target):
                                         'was probably an error' % path)
                     inputres += res
 
-                if inputres:
-                    # report only the worst case of all input sets
-                    maxrss = max(r.maxrss_kb for r in inputres)
-                    maxpagefaults = max(r.page_faults for r in inputres)
-                    maxcswitch = max(r.context_switches for r in inputres)
-                else:
-                    maxrss = maxpagefaults = maxcswitch = None
+                # the runtime library of an instance may report its own
+                # memory usage (e.g., shadow memory) in a separate begin-end
+                # block, so only take the maximum over the blocks that have
+                # the key
+                def worst(key):
+                    values = [r[key] for r in inputres if key in r]
+                    return max(values) if values else None
 
-                yield {
+                # report only the worst case of all input sets
+                maxrss = worst('maxrss_kb')
+                maxpagefaults = worst('page_faults')
+                maxcswitch = worst('context_switches')
+
+                result = {
                     'benchmark': benchmark,
                     'success': status == 'Success',
                     'workload': workload,
@@ -578,6 +590,13 @@ class SPEC2006(Target):
                     'maxcontextswitches': maxcswitch,
                     'hostname': hostname
                 }
+
+                for key in self.memory_breakdown_keys:
+                    value = worst(key)
+                    if value is not None:
+                        result[key] = value
+
+                yield result
                 error_benchmarks.remove(benchmark)
                 m = pat.search(logcontents, m.end())
 
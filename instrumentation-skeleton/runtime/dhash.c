@@ -12,9 +12,30 @@
 
 #define AMOUNT_OF_LOCKS 2
 
+//Initial (and minimum) amount of buckets of the hash table.
 #define HASHSZ 4096
 
+//The table is doubled once the average amount of registered objects per bucket exceeds HASH_MAX_LOAD, and halved once it
+//drops below HASH_MIN_LOAD.
+#define HASH_MAX_LOAD 16
+#define HASH_MIN_LOAD 2
+
+//Hash functions for the page numbers of red-zone addresses, selected by hashFunction.
+#define HASH_XOR_FOLD 0
+#define HASH_FIBONACCI 1
+#define HASH_CRC32C 2
+
+//Amount of recently found objects cached in front of the 'slow' check.
+#define HIT_CACHE_SIZE 4
+
+//Amount of buckets moved to the new table per registration/removal during a rehash.
+#define REHASH_STEP 4
+
+//Amount of executions of a check site per check, for programs instrumented with -hm-sample-checks.
+#define SAMPLE_RATE 100
+
 #define checkMemoryAccess NOINSTRUMENT(checkMemoryAccess)
+#define checkMemoryRange NOINSTRUMENT(checkMemoryRange)
 
 #define Dlib_free NOINSTRUMENT(Dlib_free)
 #define Dlib_malloc NOINSTRUMENT(Dlib_malloc)
@@ -22,13 +43,30 @@
 #define Dlib_calloc NOINSTRUMENT(Dlib_calloc)
 #define Dlib_memalign NOINSTRUMENT(Dlib_memalign)
 
+#define getPage NOINSTRUMENT(getPage)
+#define getEntryAddrL NOINSTRUMENT(getEntryAddrL)
+#define getEntryAddrR NOINSTRUMENT(getEntryAddrR)
+#define packEntry NOINSTRUMENT(packEntry)
+#define getLineBit NOINSTRUMENT(getLineBit)
+#define getRZLines NOINSTRUMENT(getRZLines)
+#define getEntryLines NOINSTRUMENT(getEntryLines)
+#define updateLines NOINSTRUMENT(updateLines)
+#define findRunInList NOINSTRUMENT(findRunInList)
+#define findAddrInList NOINSTRUMENT(findAddrInList)
+#define checkAddrInRun NOINSTRUMENT(checkAddrInRun)
+#define checkHitCache NOINSTRUMENT(checkHitCache)
+#define addHitCache NOINSTRUMENT(addHitCache)
+#define checkAddrInList NOINSTRUMENT(checkAddrInList)
 #define checkRegistration NOINSTRUMENT(checkRegistration)
+#define checkRangeRegistration NOINSTRUMENT(checkRangeRegistration)
 
 //#define calcRZSize NOINSTRUMENT(calcRZSize)
 
 //#define unloadLib NOINSTRUMENT(unloadLib)
 #define initLib NOINSTRUMENT(initLib)
 
+#define hashPage NOINSTRUMENT(hashPage)
+#define getRZAddrHash NOINSTRUMENT(getRZAddrHash)
 #define getRZAddrBucket NOINSTRUMENT(getRZAddrBucket)
 #define removeAddrFromList NOINSTRUMENT(removeAddrFromList)
 #define removeAddr NOINSTRUMENT(removeAddr)
@@ -38,16 +76,37 @@
 
 #define insertRZPattern NOINSTRUMENT(insertRZPattern)
 
+#define rehashBucket NOINSTRUMENT(rehashBucket)
+#define beginRehash NOINSTRUMENT(beginRehash)
+#define finishRehash NOINSTRUMENT(finishRehash)
+#define rehashStep NOINSTRUMENT(rehashStep)
+
+//Initial amount of words in the array of a bucket, doubled whenever the array is full.
+#define BUCKET_INITIAL_SIZE 4
+
+//Entries are packed into words, grouped in runs: one for every page with a registered red-zone in the bucket, sorted on
+//the page number. A run starts with a header word holding the page number (above RUN_COUNT_BITS) and its amount of entries,
+//followed by its entries, sorted on the address of their left red-zone. An entry holds the offset in the page of the
+//red-zone it is registered for (its left red-zone, or its right one for an object starting on an earlier page, marked by
+//ENTRY_ANCHOR_R), and the distance between both red-zones (above ENTRY_SIZE_SHIFT).
+#define RUN_COUNT_BITS 16
+#define RUN_COUNT_MASK 0xFFFFUL
+#define ENTRY_OFFSET_MASK 0xFFFFUL
+#define ENTRY_ANCHOR_R 0x10000UL
+#define ENTRY_SIZE_SHIFT 18
+
 typedef struct rzAddr{
 	void *startAddrL;
 	void*startAddrR;
-	struct rzAddr *next;
 }rzAddr;
 
+//The runs of a bucket are kept in an array of words, of which counter are used. The bitmap marks the lines (a 64th of a page)
+//containing a red-zone of the entries, see getEntryLines.
 typedef struct rzHashBucket{
 	unsigned int counter;
-	rzAddr *first;
-	rzAddr *last;
+	unsigned int size;
+	unsigned long int lines;
+	unsigned long int *entries;
 }rzHashBucket;
 
 //Originally used for the size of the shadow memory. A left-over from the ASAN implementation, but now used to calculate
@@ -60,11 +119,44 @@ static const size_t scale = 5;
 //for this, but can be changed to anything (as long as it is 8 bits/1 byte long).
 unsigned char redzone = 0x2A;
 
+//A check site instrumented with -hm-sample-checks is checked once in every __hmbounds_sample_rate executions (and on every
+//execution once it found a red-zone access). Can be set at start-up with the HMBOUNDS_SAMPLE_RATE environment variable.
+int __hmbounds_sample_rate = SAMPLE_RATE;
+
+//Checks are only done while __hmbounds_checks_enabled is set for the thread, in programs instrumented with
+//-hm-clone-unchecked (where every function runs an unchecked copy of itself while it is clear).
+__thread int __hmbounds_checks_enabled = 1;
+
 //Size of the red-zone, determined by the scale variable.
 static size_t rz_sz = 32;
 
-rzHashBucket hashTable[HASHSZ];
+//The initial hash table, used until the table first grows.
+static rzHashBucket initialHashTable[HASHSZ];
+
+//The current hash table, and its amount of buckets (always a power of two, and never smaller than HASHSZ).
+static rzHashBucket *hashTable = initialHashTable;
+static unsigned long int hashSize = HASHSZ;
+
+//The table that is being rehashed into the current table (NULL if no rehash is ongoing). Its buckets below the
+//rehash index have already been moved.
+static rzHashBucket *oldHashTable = NULL;
+static unsigned long int oldHashSize = 0;
+static unsigned long int rehashIndex = 0;
 
+//Amount of registered objects, used for the load factor of the table.
+static unsigned long int registeredAddrs = 0;
+
+//Increased on every removal, invalidating the cached objects.
+static unsigned long int removalGeneration = 0;
+
+//Objects recently found by the 'slow' check, valid for the removal generation hitGeneration.
+static rzAddr hitCache[HIT_CACHE_SIZE];
+static unsigned long int hitGeneration = 0;
+static int hitCount = 0;
+static int hitNext = 0;
+
+//Granularity at which red-zone addresses are keyed into the hash table, as the log2 of the size of a 'page' (8 for 256 bytes,
+//up to 16 for 64KB, since entries store their offset in the page in 16 bits). A page may not be smaller than a red-zone.
 static const int hashexp = 12;
 
 //Used to create a mapping from virtual memory addresses to the hash table buckets.
@@ -78,6 +170,7 @@ static unsigned long int pagesz = 0;
 //Variable for activating red-zone poison pattern checking. Deactivating this option will also disable all
 //red-zone pattern insertion, meaning red-zones will no longer be explicitly poisoned. Only the 'slow' check will be used here,
 //resulting in a performance decrease, but an increase in memory efficiency (since the red-zones will no longer be intialised).
+//Programs instrumented with the inline fast path of the pass (-hm-inline-fast-path, on by default) require this option.
 static const int fastCheckInit = 0;
 
 //Variable for enabling hash table registration. If disabled, registration will be turned off, and only the explicit poisoning of
@@ -85,6 +178,19 @@ static const int fastCheckInit = 0;
 //but will probably increase performance as well. 
 static const int useRegistration = 0;
 
+//Variable for enabling the cache of recently found objects. If enabled, repeated 'slow' checks of the same objects (e.g., a
+//loop over data holding the red-zone pattern) are answered without searching the hash table, until any object is removed.
+static const int useHitCache = 0;
+
+//Hash function used to map the page numbers of red-zone addresses to buckets: HASH_XOR_FOLD, HASH_FIBONACCI or HASH_CRC32C
+//(which uses the SSE4.2 instruction when compiled with -msse4.2). See Tests/HashBenchmark.c for a comparison.
+static const int hashFunction = HASH_FIBONACCI;
+
+//Variable for enabling the resizing of the hash table. If enabled, the table grows (and shrinks) with the amount of registered
+//objects, moving a few buckets at a time on every registration/removal. If disabled, the table keeps HASHSZ buckets, and the
+//cost of a 'slow' check grows with the size of the heap.
+static const int useRehash = 0;
+
 //This debug variable can be turned on to display error messages, or informative notes to show the user what things are going wrong.
 //When turned off, runtime is significantly lower.
 static const int debug = 1;
@@ -120,6 +226,12 @@ static int unloadLib(){
 __attribute__((constructor))
 int initLib(){
 	/* Function to set up some necessary variables/values. Called upon the use of any (callable) function. */
+	char *sampleRate;
+	sampleRate = getenv("HMBOUNDS_SAMPLE_RATE");
+	if(sampleRate != NULL && atoi(sampleRate) > 0){
+		__hmbounds_sample_rate = atoi(sampleRate);
+	}
+
 	if(useRegistration == 0){
 		pagesz = sysconf(_SC_PAGESIZE);
 		if(pagesz == 0){
@@ -145,36 +257,319 @@ int initLib(){
 }
 
 
-static int getRZAddrBucket(void *mem){
-	/* Get most significant n bits from the address. */
-	unsigned long int pageNum;
-	pageNum = ((unsigned long int) mem >> hashexp);
+static unsigned long int hashPage(unsigned long int page, int function){
+	if(function == HASH_FIBONACCI){
+		/* Multiplicative hashing. The buckets are selected by the lower bits of the hash, which only depend on the lower
+		   bits of the page number, so the upper half of the product (depending on all of them) is folded into them. */
+		unsigned long int product;
+		product = page * 11400714819323198485UL;
+
+		return (product ^ (product >> 32));
+	}else if(function == HASH_CRC32C){
+#if defined(__SSE4_2__)
+		return __builtin_ia32_crc32di(0xFFFFFFFF, page);
+#else
+		/* Bitwise equivalent of the instruction, for builds without SSE4.2. */
+		unsigned long int crc;
+		crc = 0xFFFFFFFF;
+
+		for(int i = 0; i < 64; i++){
+			crc = crc ^ ((page >> i) & 1);
+			crc = (crc >> 1) ^ (0x82F63B78 & (0 - (crc & 1)));
+		}
 
-	int bucket;
-	bucket = (((pageNum) ^ ((pageNum) >> 8) ^ ((pageNum) >> 16) ^ ((pageNum) >> 24)) & (HASHSZ -1));
+		return crc;
+#endif
+	}
 
-	return bucket;
+	return ((page) ^ ((page) >> 8) ^ ((page) >> 16) ^ ((page) >> 24));
 }
 
-static int checkRegistration(void *mem, int accessSize){
-	int rzBucket;
-	rzBucket = getRZAddrBucket(mem);
+static unsigned long int getRZAddrHash(void *mem){
+	return hashPage(((unsigned long int) mem >> hashexp), hashFunction);
+}
 
-	if(hashTable[rzBucket].counter == 0){
-		/* No red-zones registered, so addressable memory. */
-		return 0;
+static rzHashBucket *getRZAddrBucket(void *mem){
+	unsigned long int hash;
+	hash = getRZAddrHash(mem);
+
+	if(oldHashTable != NULL){
+		/* During a rehash, buckets of the old table below the rehash index have already been moved to the new table. */
+		unsigned long int oldBucket;
+		oldBucket = hash & (oldHashSize - 1);
+
+		if(oldBucket >= rehashIndex){
+			return &oldHashTable[oldBucket];
+		}
+	}
+
+	return &hashTable[hash & (hashSize - 1)];
+}
+
+static unsigned long int getPage(void *mem){
+	return ((unsigned long int) mem >> hashexp);
+}
+
+static void *getEntryAddrL(unsigned long int page, unsigned long int entry){
+	unsigned long int addr;
+	addr = (page << hashexp) + (entry & ENTRY_OFFSET_MASK);
+
+	/* An entry anchored on its right red-zone belongs to an object starting on an earlier page. */
+	if((entry & ENTRY_ANCHOR_R) != 0){
+		addr = addr - (entry >> ENTRY_SIZE_SHIFT);
+	}
+
+	return (void*) addr;
+}
+
+static void *getEntryAddrR(unsigned long int page, unsigned long int entry){
+	return getEntryAddrL(page, entry) + (entry >> ENTRY_SIZE_SHIFT);
+}
+
+static unsigned long int packEntry(rzAddr *addr, unsigned long int page){
+	unsigned long int size;
+	size = (unsigned long int) (addr->startAddrR - addr->startAddrL);
+
+	if(getPage(addr->startAddrL) == page){
+		return (size << ENTRY_SIZE_SHIFT) | ((unsigned long int) addr->startAddrL - (page << hashexp));
+	}
+
+	return (size << ENTRY_SIZE_SHIFT) | ENTRY_ANCHOR_R | ((unsigned long int) addr->startAddrR - (page << hashexp));
+}
+
+static unsigned long int getLineBit(void *mem){
+	return (1UL << (((unsigned long int) mem >> (hashexp - 6)) & 63));
+}
+
+static unsigned long int getRZLines(void *mem){
+	/* A red-zone crossing into the next page marks the first lines of the bitmap as well, which is where the address
+	   of the next page is tested. */
+	unsigned long int first;
+	first = (unsigned long int) mem >> (hashexp - 6);
+
+	unsigned long int last;
+	last = ((unsigned long int) mem + rz_sz - 1) >> (hashexp - 6);
+
+	if(last - first >= 63){
+		return ~0UL;
+	}
+
+	unsigned long int lines;
+	lines = 0;
+
+	for(unsigned long int i = first; i <= last; i++){
+		lines = lines | (1UL << (i & 63));
+	}
+
+	return lines;
+}
+
+static unsigned long int getEntryLines(unsigned long int page, unsigned long int entry){
+	/* A lookup searches the runs of the pages on which a red-zone containing the address could start, so only those
+	   red-zones need to be marked. */
+	void *startAddrL;
+	startAddrL = getEntryAddrL(page, entry);
+
+	void *startAddrR;
+	startAddrR = getEntryAddrR(page, entry);
+
+	unsigned long int lines;
+	lines = 0;
+
+	if(getPage(startAddrL) == page){
+		lines = lines | getRZLines(startAddrL);
+	}
+
+	if(getPage(startAddrR) == page){
+		lines = lines | getRZLines(startAddrR);
+	}
+
+	return lines;
+}
+
+static void updateLines(rzHashBucket *bucket){
+	/* Recalculate the bitmap of a bucket after a removal. */
+	bucket->lines = 0;
+
+	unsigned int index;
+	index = 0;
+
+	while(index < bucket->counter){
+		unsigned long int page;
+		page = bucket->entries[index] >> RUN_COUNT_BITS;
+
+		unsigned int count;
+		count = (unsigned int) (bucket->entries[index] & RUN_COUNT_MASK);
+
+		for(unsigned int i = index + 1; i <= index + count; i++){
+			bucket->lines = bucket->lines | getEntryLines(page, bucket->entries[i]);
+		}
+
+		index = index + 1 + count;
+	}
+}
+
+static int findRunInList(unsigned long int page, rzHashBucket *bucket, unsigned int *runCount){
+	/* A bucket holds the runs of only a few pages on average, so they are searched linearly. Returns the index of the
+	   first run of a higher page (encoded as -2 - index) if the page has no run, which is where it would be inserted. */
+	unsigned int index;
+	index = 0;
+
+	while(index < bucket->counter){
+		unsigned long int header;
+		header = bucket->entries[index];
+
+		if((header >> RUN_COUNT_BITS) == page){
+			*runCount = (unsigned int) (header & RUN_COUNT_MASK);
+			return (int) index;
+		}else if((header >> RUN_COUNT_BITS) > page){
+			break;
+		}
+
+		index = index + 1 + (unsigned int) (header & RUN_COUNT_MASK);
+	}
+
+	return -2 - (int) index;
+}
+
+static int findAddrInList(void *mem, unsigned long int page, rzHashBucket *bucket){
+	/* Binary search for the last entry of the (sorted) run with a left red-zone starting at or before mem. Since
+	   registered objects never overlap, this is the only entry of the run whose red-zones can contain mem. */
+	unsigned int runCount;
+	runCount = 0;
+
+	int run;
+	run = findRunInList(page, bucket, &runCount);
+	if(run < 0){
+		return -1;
+	}
+
+	int low;
+	low = run + 1;
+
+	int high;
+	high = run + 1 + (int) runCount;
+
+	while(low < high){
+		int middle;
+		middle = (low + high) / 2;
+
+		if(getEntryAddrL(page, bucket->entries[middle]) <= mem){
+			low = middle + 1;
+		}else{
+			high = middle;
+		}
 	}
 
-	/* If memory is not at all in the range between the first and last entries, it means the address
-	   is nowhere in the list (we can do this because the list is ordered). */
-	if(hashTable[rzBucket].first->startAddrL > mem){
-		/* The memory address given is smaller than the left-most red-zone. */
+	if(low == run + 1){
+		return -1;
+	}
+
+	return low - 1;
+}
+
+static int checkAddrInRun(void *mem, unsigned long int page, rzAddr *hit){
+	/* Returns 1 if mem lies in a red-zone registered in the run of the given page, 0 otherwise. If an object containing
+	   mem (including its red-zones) is found, it is written into hit. */
+	rzHashBucket *bucket;
+	bucket = getRZAddrBucket((void*) (page << hashexp));
+
+	/* Most addresses looked up are not in a red-zone at all (but merely hold the same value), so the line of the address
+	   is tested before searching the entries. */
+	if((bucket->lines & getLineBit(mem)) == 0){
+		/* No red-zones registered on this line, so addressable memory. */
 		return 0;
-	}else if((hashTable[rzBucket].last->startAddrR + rz_sz) < mem){
-		/* The memory address given is greater than the right-most red-zone. */
+	}
+
+	int index;
+	index = findAddrInList(mem, page, bucket);
+	if(index == -1){
 		return 0;
 	}
 
+	void *startAddrL;
+	startAddrL = getEntryAddrL(page, bucket->entries[index]);
+
+	void *startAddrR;
+	startAddrR = getEntryAddrR(page, bucket->entries[index]);
+
+	if(mem < startAddrR + rz_sz){
+		hit->startAddrL = startAddrL;
+		hit->startAddrR = startAddrR;
+	}
+
+	if((startAddrL <= mem && mem < startAddrL + rz_sz) || (startAddrR <= mem && mem < startAddrR + rz_sz)){
+		return 1;
+	}
+
+	return 0;
+}
+
+static int checkHitCache(void *mem){
+	/* Returns -1 if none of the cached objects contains mem. */
+	if(removalGeneration != hitGeneration){
+		hitGeneration = removalGeneration;
+		hitCount = 0;
+		hitNext = 0;
+
+		return -1;
+	}
+
+	for(int i = 0; i < hitCount; i++){
+		rzAddr *current;
+		current = &hitCache[i];
+
+		if(current->startAddrL <= mem && mem < current->startAddrR + rz_sz){
+			if(mem < current->startAddrL + rz_sz || current->startAddrR <= mem){
+				return 1;
+			}
+
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+static void addHitCache(rzAddr *hit){
+	hitCache[hitNext] = *hit;
+	hitNext = (hitNext + 1) % HIT_CACHE_SIZE;
+
+	if(hitCount < HIT_CACHE_SIZE){
+		hitCount++;
+	}
+}
+
+static int checkAddrInList(void *mem){
+	/* Returns 1 if mem lies in a registered red-zone, 0 otherwise. A red-zone containing mem may start on the previous
+	   page, in which case it is registered in the run of that page. */
+	int found;
+
+	if(useHitCache == 0){
+		found = checkHitCache(mem);
+		if(found != -1){
+			return found;
+		}
+	}
+
+	rzAddr hit;
+	hit.startAddrL = NULL;
+	hit.startAddrR = NULL;
+
+	found = checkAddrInRun(mem, getPage(mem), &hit);
+
+	if(found == 0 && getPage(mem - (rz_sz - 1)) != getPage(mem)){
+		found = checkAddrInRun(mem, getPage(mem - (rz_sz - 1)), &hit);
+	}
+
+	if(useHitCache == 0 && hit.startAddrL != NULL){
+		addHitCache(&hit);
+	}
+
+	return found;
+}
+
+static int checkRegistration(void *mem, int accessSize){
 	void *addedMem;
 	addedMem = 0;
 
@@ -184,14 +579,10 @@ static int checkRegistration(void *mem, int accessSize){
 		addedMem = mem;
 	}
 
-	for(rzAddr *current = hashTable[rzBucket].first; current != (rzAddr*) NULL; current = current->next){
-		if((current->startAddrL <= mem && mem < current->startAddrL + rz_sz) || (current->startAddrR <= mem && mem < current->startAddrR + rz_sz) ||
-			(current->startAddrL <= addedMem && addedMem < current->startAddrL + rz_sz) || (current->startAddrR <= addedMem && addedMem < current->startAddrR + rz_sz)){
-			printf("ERROR: ATTEMPTING TO ACCESS UNADDRESSABLE (REDZONE) MEMORY.\n");
-			return 1;
-		}else{
-			continue;
-		}
+	/* The last byte of the access is looked up in its own bucket, since it may lie on the next page. */
+	if(checkAddrInList(mem) == 1 || (addedMem != mem && checkAddrInList(addedMem) == 1)){
+		printf("ERROR: ATTEMPTING TO ACCESS UNADDRESSABLE (REDZONE) MEMORY.\n");
+		return 1;
 	}
 
 	/* Memory address was not found in hash table, meaning it is addressable (or there is a very
@@ -294,270 +685,251 @@ int checkMemoryAccess(void *mem, int accessSize){
 	return -1;
 }
 
-static rzAddr *removeAddrFromList(rzAddr *toRemove, int rzBucket){
-	int found;
-	found = -1;
+static int checkRangeRegistration(void *mem, size_t size){
+	/* A red-zone overlapping the range either contains one of its ends, or lies within it. Since it spans rz_sz bytes, it
+	   then contains one of the addresses at a stride of rz_sz from the start of the range. */
+	for(size_t offset = 0; offset < size; offset += rz_sz){
+		if(checkRegistration(mem + offset, 1) == 1){
+			return 1;
+		}
+	}
 
-	rzAddr *current;
-	current = NULL;
+	return checkRegistration(mem + (size - 1), 1);
+}
 
-	rzAddr *prev;
-	prev = NULL;
+__attribute__((used))
+int checkMemoryRange(void *mem, size_t size){
+	/* Returns a negative integer if the address was invalid, 0 if no byte of the range lies in a red-zone, and a positive
+	   integer otherwise. Used for all accesses of a loop at once, checked before the loop. */
+	if(debug == 0 && mem == NULL){
+		return -1;
+	}
 
-	if(hashTable[rzBucket].counter == 0){
-		printf("ERROR: NO REDZONES REGISTERED.\n");
-		return NULL;
-	}else{
-		for(current = hashTable[rzBucket].first; current != (rzAddr*) NULL; current = current->next){
-			if((current->startAddrL == toRemove->startAddrL) || (current->startAddrR == toRemove->startAddrR)){
-				found = 0;
+	if(size == 0){
+		return 0;
+	}
 
-				if(current->next == NULL){
-					if(prev == NULL){
-						hashTable[rzBucket].first = NULL;
-						hashTable[rzBucket].last = NULL;
+	if(useRegistration == 0 && fastCheckInit == 1){
+		/* Without the pattern, every red-zone that might overlap the range is looked up. */
+		return checkRangeRegistration(mem, size);
+	}
 
-						break;
-					}else{
-						prev->next = NULL;
-						hashTable[rzBucket].last = prev;
+	unsigned char *current;
+	current = mem;
 
-						break;
-					}
-				}else if(prev == NULL){
-					hashTable[rzBucket].first = current->next;
+	unsigned char *end;
+	end = mem + size;
 
-					break;
-				}else{
-					prev->next = current->next;
+	while(current < end){
+		/* Only a run of the pattern can be (a part of) a red-zone. */
+		unsigned char *start;
+		start = memchr(current, redzone, end - current);
 
-					break;
-				}
-			}
+		if(start == NULL){
+			return 0;
+		}
+
+		if(useRegistration == 1){
+			/* In this mode, the pattern is the only detection mechanism. */
+			return 1;
+		}
 
-			/* Save the current entry, for list arithmetic. */
-			prev = current;
+		current = start;
+		while(current < end && *current == redzone){
+			current++;
 		}
 
-		hashTable[rzBucket].counter--;
+		if(checkRangeRegistration(start, current - start) == 1){
+			return 1;
+		}
 	}
 
-	
-	if(found != 0){
+	return 0;
+}
+
+//Performs a part of an ongoing rehash (see the rehash functions below), called on every registration and removal.
+static void rehashStep();
+
+static int removeAddrFromList(rzAddr *toRemove, rzHashBucket *bucket, unsigned long int page){
+	/* Remove the entry with the given left red-zone address from the run of the page, and return the right red-zone
+	   address recorded for it in toRemove. */
+	if(bucket->counter == 0){
+		printf("ERROR: NO REDZONES REGISTERED.\n");
+		return 1;
+	}
+
+	int index;
+	index = findAddrInList(toRemove->startAddrL, page, bucket);
+
+	if(index == -1 || getEntryAddrL(page, bucket->entries[index]) != toRemove->startAddrL){
 		printf("ERROR: NO REDZONE FOUND FOR REMOVAL.\n");
-		return NULL;
-	}else{
-		return current;
+		return 1;
 	}
-}
 
-static int removeAddr(void *memL, void *memR){
-	rzAddr *current;
-	current = NULL;
+	toRemove->startAddrR = getEntryAddrR(page, bucket->entries[index]);
 
-	rzAddr *crossCurrent;
-	crossCurrent = NULL;
+	unsigned int runCount;
+	runCount = 0;
 
-	int lrzBucket;
-	lrzBucket = -1;
+	int run;
+	run = findRunInList(page, bucket, &runCount);
 
-	int rrzBucket;
-	rrzBucket = -1;
+	/* Remove the header as well if this was the last entry of the run. */
+	int first;
+	first = index;
 
-	int addrLock;
-	addrLock = -1;
+	unsigned int amount;
+	amount = 1;
 
-	int standardCrossAlloc;
-	standardCrossAlloc = -1;
+	if(runCount == 1){
+		first = run;
+		amount = 2;
+	}else{
+		bucket->entries[run]--;
+	}
+
+	memmove(&bucket->entries[first], &bucket->entries[first + amount], (bucket->counter - first - amount) * sizeof(unsigned long int));
+	bucket->counter = bucket->counter - amount;
+
+	updateLines(bucket);
 
-	int memRUnknown;
-	memRUnknown = -1;
+	if(bucket->size > BUCKET_INITIAL_SIZE && bucket->counter < bucket->size / 4){
+		/* Give memory back after a bucket emptied out (e.g., after a phase with many small allocations). */
+		unsigned long int *entries;
+		entries = (unsigned long int*) realloc(bucket->entries, (bucket->size / 2) * sizeof(unsigned long int));
+		if(entries != NULL){
+			bucket->entries = entries;
+			bucket->size = bucket->size / 2;
+		}
+	}
 
-	int firstAddrLock;
-	firstAddrLock = 0;
+	return 0;
+}
+
+static int removeAddr(void *memL, void *memR){
+	rzHashBucket *lrzBucket;
+	lrzBucket = NULL;
 
-	int secondAddrLock;
-	secondAddrLock = 0;
+	rzHashBucket *rrzBucket;
+	rrzBucket = NULL;
 
 	if(debug == 0 && memL == NULL){
 		/* We always require the left red-zone address to perform a remove. The address of the right red-zone is
-		   optional. */
+		   optional, since it is recorded in the entry of the left red-zone. */
 		printf("ERROR: INVALID STARTING ADDRESS PROVIDED.\n");
 		return 1;
-	}else if(memR == NULL){
-		/* This means that the right red-zone address is unknown on deallocation. This is possible for any free
-		   since we cannot extract the right red-zone address directly from the pointer given to free(). */
-		lrzBucket = getRZAddrBucket(memL);
-		memRUnknown= 0;
-	}else{
-		lrzBucket = getRZAddrBucket(memL);
-		rrzBucket = getRZAddrBucket(memR);
-		if(lrzBucket != rrzBucket){
-			/* A cross-page allocation occurred, meaning that we require this entry to be saved in different buckets
-			   at the same time. */
-			standardCrossAlloc = 0;
-		}
-	}
-	
-	/* The very first bucket is 0, the very last bucket is 255. */
-	if(debug == 0 && (!(lrzBucket >= 0 && lrzBucket < HASHSZ))){
-		return 1;
 	}
 
-	if(memRUnknown != 0){
-		if(debug == 0 && (!(rrzBucket >= 0 && rrzBucket < HASHSZ))){
-			return 1;
-		}
-	}
+	lrzBucket = getRZAddrBucket(memL);
 
-	/* Used to find list entry, and to remove and deallocate it from the list and memory. */
+	/* Used to find the entry. The right red-zone address is unknown on a deallocation (it cannot be extracted from the
+	   pointer given to free()), so it is recovered from the entry. */
 	rzAddr toRemove;
 	toRemove.startAddrL = memL;
 	toRemove.startAddrR = memR;
 
-	if(memRUnknown == 0){
-		current = removeAddrFromList(&toRemove, lrzBucket);
-		if(debug == 0 && current == NULL){
-			return 1;
-		}
+	if(removeAddrFromList(&toRemove, lrzBucket, getPage(memL)) == 1){
+		return 1;
+	}
 
-		/* Recover the right red-zone address from the left red-zone entry (from the known bucket), and
-		   use it to now find the other entry in the different bucket (if a cross-page allocation occurred). */
-		if(debug == 0 && current->startAddrR == NULL){
-			/* The memory was recorded as only having a left red-zone. Therefore, we perform no additional steps.
-			   This, technically, is possible, but should not happen. We error, but do not exit, since it
-			   is not a fatal error. */
+	if(debug == 0 && toRemove.startAddrR == NULL){
+		/* The memory was recorded as only having a left red-zone. This, technically, is possible, but should not happen.
+		   We error, but do not exit, since it is not a fatal error. */
+		printf("ERROR: NO RIGHT RED-ZONE RECORDED.\n");
+		return 1;
+	}
 
-			printf("ERROR: NO RIGHT RED-ZONE RECORDED.\n");
-			free(current);
-			return 1;
-		}else{
-			toRemove.startAddrR = current->startAddrR;
-		}
-		
+	/* If the pages are different, this means a cross-page allocation was performed. Then, the entry must be removed
+	   from the run of that specific page as well. */
+	if(getPage(toRemove.startAddrR) != getPage(memL)){
 		rrzBucket = getRZAddrBucket(toRemove.startAddrR);
 
-		if(debug == 0 && (!(rrzBucket >= 0 && rrzBucket < HASHSZ))){
-			free(current);
-
+		if(removeAddrFromList(&toRemove, rrzBucket, getPage(toRemove.startAddrR)) == 1){
 			return 1;
 		}
+	}
 
-		/* If the buckets are different, this means a cross-page allocation was performed. Then, the
-		   entry must be removed from that specific bucket as well. If they are equal, the entry can simply be deallocated,
-		   meaning that the removal was successful. */
-		if(rrzBucket != lrzBucket){
-			crossCurrent = removeAddrFromList(&toRemove, rrzBucket);
-			if(debug == 0 && crossCurrent == NULL){
-				free(current);
+	removalGeneration++;
+	registeredAddrs--;
+	rehashStep();
 
-				return 1;
-			}
+	return 0;
+}
 
-			/* Free the cross-allocated entry which originates from a different bucket. */
-			free(crossCurrent);
-		}
-	}else if(standardCrossAlloc == 0){
-		current = removeAddrFromList(&toRemove, lrzBucket);
-		if(debug == 0 && current == NULL){
-			return 1;
+static int addAddrToList(rzAddr *toAdd, rzHashBucket *bucket, unsigned long int page){
+	if(bucket->counter + 2 > bucket->size){
+		/* Grow the array of the bucket (room for the entry, and possibly the header of a new run). */
+		unsigned int size;
+		size = bucket->size * 2;
+		if(size == 0){
+			size = BUCKET_INITIAL_SIZE;
 		}
 
-		crossCurrent = removeAddrFromList(&toRemove, rrzBucket);
-		if(debug == 0 && crossCurrent == NULL){
-			free(current);
-
+		unsigned long int *entries;
+		entries = (unsigned long int*) realloc(bucket->entries, size * sizeof(unsigned long int));
+		if(entries == NULL){
 			return 1;
 		}
 
-		/* Free the cross-allocated entry which originates from a different bucket. */
-		free(crossCurrent);
-	}else{
-		/* This branch is used if and only if the left and right red-zone buckets match, meaning only the
-		   left bucket can be used for removing the entry (since the list referred to by both buckets is the same). */
-		current = removeAddrFromList(&toRemove, lrzBucket);
-		if(debug == 0 && current == NULL){
-			return 1;
-		}
+		bucket->entries = entries;
+		bucket->size = size;
 	}
 
-	/* Free the removed entry from the hash table list. */
-	free(current);
+	unsigned int runCount;
+	runCount = 0;
 
-	return 0;
-}
-
-static int addAddrToList(rzAddr *toAdd, int rzBucket){
-	rzAddr *current;
-	current = NULL;
+	int run;
+	run = findRunInList(page, bucket, &runCount);
 
-	rzAddr *prev;
-	prev = NULL;
+	if(run < 0){
+		/* Start a new run for the page, in its (sorted) position. */
+		int index;
+		index = -2 - run;
 
-	if(hashTable[rzBucket].counter == 0 && hashTable[rzBucket].first == NULL){
-		/* The new entry will become the first. */
-		hashTable[rzBucket].first = toAdd;
-		hashTable[rzBucket].last = toAdd;
-	}else if(hashTable[rzBucket].last->startAddrR < toAdd->startAddrL){
-		/* It was observed that addresses are often allocated increasingly (in size). Therefore, starting at the end with
-		   adding is more efficient (with this additional branch). */
-		hashTable[rzBucket].last->next = toAdd;
-		hashTable[rzBucket].last = toAdd;
-	}else{
-		for(current = hashTable[rzBucket].first; current != (rzAddr*) NULL; current = current->next){
-			/* Compare the red-zone entry. */
-			if((current->startAddrL == toAdd->startAddrL) || (current->startAddrR == toAdd->startAddrR)){
-				/* Red-zone (or part of it) already in the table. */
-				printf("ERROR: REDZONE ALREADY REGISTERED.\n");
-				return 1;
-			}else if(toAdd->startAddrR < current->startAddrL){
-				if(prev == NULL){
-					hashTable[rzBucket].first = toAdd;
-					toAdd->next = current;
+		memmove(&bucket->entries[index + 2], &bucket->entries[index], (bucket->counter - index) * sizeof(unsigned long int));
+		bucket->entries[index] = (page << RUN_COUNT_BITS) | 1;
+		bucket->entries[index + 1] = packEntry(toAdd, page);
+		bucket->counter = bucket->counter + 2;
+		bucket->lines = bucket->lines | getEntryLines(page, bucket->entries[index + 1]);
 
-					break;
-				}else{
-					prev->next = toAdd;
-					toAdd->next = current;
+		return 0;
+	}
 
-					break;
-				}
-			}
+	int index;
+	index = run + 1 + (int) runCount;
 
-			/* Save the previous entry. */
-			prev = current;
+	if(!(getEntryAddrL(page, bucket->entries[index - 1]) < toAdd->startAddrL)){
+		/* It was observed that addresses are often allocated increasingly, in which case the entry is simply appended
+		   to its run. Otherwise, find the position of the entry with a binary search. */
+		index = findAddrInList(toAdd->startAddrL, page, bucket) + 1;
+		if(index == 0){
+			index = run + 1;
 		}
 	}
 
-	hashTable[rzBucket].counter++;
-
-	return 0;
-}
-
-static int registerAddr(void *memL, void *memR){
-	if(memL == NULL && memR == NULL){
+	/* Compare the red-zone entry with its neighbours in the run. */
+	if((index > run + 1 && (getEntryAddrL(page, bucket->entries[index - 1]) == toAdd->startAddrL || getEntryAddrR(page, bucket->entries[index - 1]) == toAdd->startAddrR)) ||
+		(index < run + 1 + (int) runCount && getEntryAddrR(page, bucket->entries[index]) == toAdd->startAddrR)){
+		/* Red-zone (or part of it) already in the table. */
+		printf("ERROR: REDZONE ALREADY REGISTERED.\n");
 		return 1;
 	}
 
-	rzAddr *toAdd;
-	toAdd = NULL;
-
-	/* Only exists for cross-page allocations. If the same pointer is used in different lists, list arithmetic
-	   cannot be trusted. */
-	rzAddr *crossToAdd;
-	toAdd = NULL;
-
-	int lrzBucket;
-	lrzBucket = -1;
+	memmove(&bucket->entries[index + 1], &bucket->entries[index], (bucket->counter - index) * sizeof(unsigned long int));
+	bucket->entries[index] = packEntry(toAdd, page);
+	bucket->entries[run]++;
+	bucket->counter++;
+	bucket->lines = bucket->lines | getEntryLines(page, bucket->entries[index]);
 
-	int rrzBucket;
-	rrzBucket = -1;
+	return 0;
+}
 
-	int crossAlloc;
-	crossAlloc = -1;
+static int registerAddr(void *memL, void *memR){
+	rzHashBucket *lrzBucket;
+	lrzBucket = NULL;
 
-	int check;
-	check = -1;
+	rzHashBucket *rrzBucket;
+	rrzBucket = NULL;
 
 	if(debug == 0 && (memL == NULL || memR == NULL)){
 		/* Requires two valid red-zone addresses for a register. */
@@ -567,69 +939,29 @@ static int registerAddr(void *memL, void *memR){
 	lrzBucket = getRZAddrBucket(memL);
 	rrzBucket = getRZAddrBucket(memR);
 
-	if(lrzBucket != rrzBucket){
-		/* A cross-page allocation occurred, meaning that we require this entry to be saved in different buckets
-		   at the same time. */
-		crossAlloc = 0;
-	}
-	
-	/* The very first bucket is 0, the very last bucket is 255. Check if the selected bucket(s) are valid. */
-	if(debug == 0 && (!(lrzBucket >= 0 && lrzBucket < HASHSZ))){
-		return 1;
-	}
-
-	if(debug == 0 && (!(rrzBucket >= 0 && rrzBucket < HASHSZ))){
-		return 1;
-	}
+	/* The entry is packed into the run of the page of both red-zones. */
+	rzAddr toAdd;
+	toAdd.startAddrL = memL;
+	toAdd.startAddrR = memR;
 
-	toAdd = (rzAddr*) malloc(sizeof(struct rzAddr));
-	if(toAdd == NULL){
+	if(addAddrToList(&toAdd, lrzBucket, getPage(memL)) == 1){
 		return 1;
 	}
 
-	toAdd->startAddrL = memL;
-	toAdd->startAddrR = memR;
-	toAdd->next = NULL;
-
-	if(crossAlloc == 0){
-		check = addAddrToList(toAdd, lrzBucket);
-		if(debug == 0 && (check == 1 || check == -1)){
-			free(toAdd);
-			return 1;
-		}
-
-		check = -1;
-
-		crossToAdd = (rzAddr*) malloc(sizeof(struct rzAddr));
-		if(debug == 0 && crossToAdd == NULL){
-			return 1;
-		}
-
-		crossToAdd->startAddrL = memL;
-		crossToAdd->startAddrR = memR;
-		crossToAdd->next = NULL;
-
-		check = addAddrToList(crossToAdd, rrzBucket);		
-		if(debug == 0 && (check == 1 || check == -1)){
-			/* If this occurs, everything will break. */
-			free(crossToAdd);
-			
-			if(removeAddr(memL, memR) == 1){
-				/* Fatal memory error. */
-			}
-
-			return 1;
-		}
-	}else{
-		check = addAddrToList(toAdd, lrzBucket);
-		if(debug == 0 && (check == 1 || check == -1)){
-			free(toAdd);
+	if(getPage(memL) != getPage(memR)){
+		/* A cross-page allocation occurred, meaning that we require this entry to be saved in different runs
+		   at the same time. */
+		if(addAddrToList(&toAdd, rrzBucket, getPage(memR)) == 1){
+			/* Undo the registration in the run of the left red-zone. */
+			removeAddrFromList(&toAdd, lrzBucket, getPage(memL));
 
 			return 1;
 		}
-
 	}
 
+	registeredAddrs++;
+	rehashStep();
+
 	return 0;
 }
 
@@ -651,6 +983,105 @@ static int insertRZPattern(void *mem, size_t size){
 	return 0;
 }
 
+/*----------------Rehash Functions----------------*/
+static int rehashBucket(unsigned long int oldBucket){
+	/* Move the runs of a bucket of the old table to the new table. Every run belongs to a single page, and is only stored
+	   in the bucket of that page, so its entries are simply added to the run of the page in the new table. */
+	rzHashBucket *bucket;
+	bucket = &oldHashTable[oldBucket];
+
+	int check;
+	check = 0;
+
+	unsigned int index;
+	index = 0;
+
+	while(index < bucket->counter){
+		unsigned long int page;
+		page = bucket->entries[index] >> RUN_COUNT_BITS;
+
+		unsigned int count;
+		count = (unsigned int) (bucket->entries[index] & RUN_COUNT_MASK);
+
+		rzHashBucket *newBucket;
+		newBucket = &hashTable[getRZAddrHash((void*) (page << hashexp)) & (hashSize - 1)];
+
+		for(unsigned int i = index + 1; i <= index + count; i++){
+			rzAddr current;
+			current.startAddrL = getEntryAddrL(page, bucket->entries[i]);
+			current.startAddrR = getEntryAddrR(page, bucket->entries[i]);
+
+			if(addAddrToList(&current, newBucket, page) == 1){
+				printf("ERROR: FAILED TO MOVE REDZONE DURING REHASH.\n");
+				check = 1;
+			}
+		}
+
+		index = index + 1 + count;
+	}
+
+	free(bucket->entries);
+	bucket->entries = NULL;
+	bucket->counter = 0;
+	bucket->lines = 0;
+	bucket->size = 0;
+
+	return check;
+}
+
+static int beginRehash(unsigned long int newSize){
+	/* Only the (empty) buckets are allocated, the entries are moved incrementally by rehashStep. */
+	rzHashBucket *newTable;
+	newTable = (rzHashBucket*) calloc(newSize, sizeof(struct rzHashBucket));
+	if(newTable == NULL){
+		return 1;
+	}
+
+	oldHashTable = hashTable;
+	oldHashSize = hashSize;
+	rehashIndex = 0;
+
+	hashTable = newTable;
+	hashSize = newSize;
+
+	return 0;
+}
+
+static void finishRehash(){
+	/* The initial table is statically allocated. */
+	if(oldHashTable != initialHashTable){
+		free(oldHashTable);
+	}
+
+	oldHashTable = NULL;
+	oldHashSize = 0;
+}
+
+static void rehashStep(){
+	if(useRehash != 0){
+		return;
+	}
+
+	if(oldHashTable == NULL){
+		if(registeredAddrs > hashSize * HASH_MAX_LOAD){
+			beginRehash(hashSize * 2);
+		}else if(hashSize > HASHSZ && registeredAddrs < hashSize * HASH_MIN_LOAD){
+			beginRehash(hashSize / 2);
+		}
+	}else{
+		/* Move a few buckets per operation, so no single allocation or deallocation pays for the entire rehash. */
+		for(int i = 0; i < REHASH_STEP && rehashIndex < oldHashSize; i++){
+			rehashBucket(rehashIndex);
+			rehashIndex++;
+		}
+
+		if(rehashIndex == oldHashSize){
+			finishRehash();
+		}
+	}
+}
+/*--------------------------------*/
+
 /* This function assumes alignment is in order when freeing memory. */
 __attribute__((used))
 void Dlib_free(void *mem){
@@ -13,7 +13,10 @@
 
 #include <sys/mman.h>
 
+#include <report.h>
+
 #define checkMemoryAccess NOINSTRUMENT(checkMemoryAccess)
+#define checkMemoryRange NOINSTRUMENT(checkMemoryRange)
 
 #define Dlib_free NOINSTRUMENT(Dlib_free)
 #define Dlib_malloc NOINSTRUMENT(Dlib_malloc)
@@ -22,9 +25,19 @@
 #define Dlib_memalign NOINSTRUMENT(Dlib_memalign)
 
 #define checkRegistration NOINSTRUMENT(checkRegistration)
+#define checkRegistrationVector NOINSTRUMENT(checkRegistrationVector)
+#define checkShadowWord NOINSTRUMENT(checkShadowWord)
 
 #define unmapShadowMemory NOINSTRUMENT(unmapShadowMemory)
 #define initShadowMemory NOINSTRUMENT(initShadowMemory)
+#define populateShadowMemory NOINSTRUMENT(populateShadowMemory)
+#define prefaultShadowMemory NOINSTRUMENT(prefaultShadowMemory)
+
+#define childFork NOINSTRUMENT(childFork)
+
+#define markShadowChunks NOINSTRUMENT(markShadowChunks)
+#define getCommittedShadowMemory NOINSTRUMENT(getCommittedShadowMemory)
+#define reportShadowMemory NOINSTRUMENT(reportShadowMemory)
 
 #define getShadowMemoryAddress NOINSTRUMENT(getShadowMemoryAddress)
 
@@ -44,6 +57,13 @@
 
 #define insertRZPattern NOINSTRUMENT(insertRZPattern)
 
+#define getGuardedBlock NOINSTRUMENT(getGuardedBlock)
+#define getGuardedBlockSize NOINSTRUMENT(getGuardedBlockSize)
+#define checkGuardedBlock NOINSTRUMENT(checkGuardedBlock)
+#define insertGuardedBlock NOINSTRUMENT(insertGuardedBlock)
+#define allocateGuardedBlock NOINSTRUMENT(allocateGuardedBlock)
+#define freeGuardedBlock NOINSTRUMENT(freeGuardedBlock)
+
 typedef struct memSeg{
 	struct memSeg *next;
 	size_t allocsz;
@@ -59,12 +79,37 @@ typedef struct freeList{
 	size_t size;
 }freeList;
 
+typedef struct guardedBlock{
+	void *start;
+	size_t size;
+
+	void *mapStart;
+	size_t mapLength;
+}guardedBlock;
+
 //IFDEF for big-endian change calc for address to () mem >> 7, and for little-endian 7 - () mem >> 7?
 
 #define ADDRSPACE_BITS 47
 #define SIZE ((1ULL<<ADDRSPACE_BITS) / 8)
 #define LOC 0x6600000000ULL
 
+//The shadow memory is pre-faulted in chunks of the size of a transparent huge page (2 MB on x86-64), which covers 16 MB of heap.
+#define SHADOW_CHUNK_SIZE (1ULL << 21)
+#define SHADOW_WINDOWS 4
+
+//Amount of shadow chunks in the complete shadow memory, used for the accounting of the written chunks.
+#define SHADOW_CHUNKS (SIZE / SHADOW_CHUNK_SIZE)
+
+//Largest part of a range (see checkMemoryRange) checked as a single access.
+#define RANGE_PART (1 << 30)
+
+//Amount of executions of a check site per check, for programs instrumented with -hm-sample-checks.
+#define SAMPLE_RATE 100
+
+//Modes for the shadow memory of a child process after a fork().
+#define FORK_SHADOW_COPY 0
+#define FORK_SHADOW_WIPE 1
+
 //The following macro computes the offset into the byte (array).
 #define BIT_OFFSET(bit) ((bit) / 8)
  
@@ -97,9 +142,64 @@ static const size_t scale = 5;
 //for this, but can be changed to anything (as long as it is 8 bits/1 byte long).
 static const unsigned char redzone = 0x2A;
 
+//A check site instrumented with -hm-sample-checks is checked once in every __hmbounds_sample_rate executions (and on every
+//execution once it found a red-zone access). Can be set at start-up with the HMBOUNDS_SAMPLE_RATE environment variable.
+int __hmbounds_sample_rate = SAMPLE_RATE;
+
+//Checks are only done while __hmbounds_checks_enabled is set for the thread, in programs instrumented with
+//-hm-clone-unchecked (where every function runs an unchecked copy of itself while it is clear).
+__thread int __hmbounds_checks_enabled = 1;
+
 //Size of the red-zone, determined by the scale variable.
 static const size_t rz_sz = 32;
 
+//Size of the system pages, used for pre-faulting the shadow memory when huge pages are unavailable.
+static unsigned long int pagesz = 4096;
+
+//A window of shadow memory that has already been pre-faulted. A few windows are kept, since the heap (brk) and the
+//mmap() regions used for large allocations lie far apart in the address space.
+typedef struct shadowWindow{
+	unsigned long long int start;
+	unsigned long long int end;
+}shadowWindow;
+
+static shadowWindow shadowWindows[SHADOW_WINDOWS];
+
+//The window that is replaced next whenever a shadow chunk outside of all windows is pre-faulted.
+static int nextShadowWindow = 0;
+
+//Amount of shadow chunks pre-faulted beyond the end of the chunk(s) needed for a registration. A larger value results in
+//fewer (but larger) bulk pre-faults whenever the heap grows.
+static const size_t shadowPrefaultAhead = 1;
+
+//Amount of shadow chunks pre-faulted so far. Compare against the minor page faults (getrusage) to tune the values above.
+static size_t shadowPrefaultedChunks = 0;
+
+//Bitmap of the shadow chunks written (or pre-faulted) at least once, one bit per chunk. Only these chunks are inspected with
+//mincore() when the committed shadow memory is reported, instead of the entire (mostly unused) mapping.
+static unsigned char shadowChunkMap[SHADOW_CHUNKS / 8];
+
+//Bytes of the red-zones of all live allocations (including the red-zones of the free-list blocks).
+static size_t redzoneBytes = 0;
+
+//Bytes of memory cached in the free-lists, ready for re-use.
+static size_t freeListBytes = 0;
+
+//Bytes of allocator metadata (the memSeg entries of the free-lists).
+static size_t metadataBytes = 0;
+
+//Allocations of at least this size are served as guarded blocks (only used if useGuardPages is enabled).
+static const size_t guardPageThreshold = 256 * 1024;
+
+//The table of guarded blocks, sorted on the start of their mappings, and the range of addresses covered by all of them. A check
+//only searches the table if the address lies within this range.
+static guardedBlock *guardedBlocks = NULL;
+static size_t guardedBlockCount = 0;
+static size_t guardedBlockCapacity = 0;
+
+static unsigned long long int guardedLow = 0;
+static unsigned long long int guardedHigh = 0;
+
 /*----------------Environment Variables----------------*/
 
 //SET TO 0 TO ENABLE!
@@ -108,6 +208,7 @@ static const size_t rz_sz = 32;
 //Variable for activating red-zone poison pattern checking. Deactivating this option will also disable all
 //red-zone pattern insertion, meaning red-zones will no longer be explicitly poisoned. Only the 'slow' check will be used here,
 //resulting in a performance decrease, but an increase in memory efficiency (since the red-zones will no longer be intialised).
+//Programs instrumented with the inline fast path of the pass (-hm-inline-fast-path, on by default) require this option.
 static const int fastCheckInit = 0;
 
 //Variable for activating the different method of keeping track of addressibility in the shadow memory. The first, which is
@@ -137,6 +238,41 @@ static const int standardPreAllocSize = 10;
 //but will probably increase performance as well. 
 static const int useRegistration = 0;
 
+//Variable for backing the shadow memory with transparent huge pages. If enabled, the shadow memory is advised to use huge pages
+//(MADV_HUGEPAGE), and the shadow chunks covering newly used heap memory are pre-faulted in bulk, instead of page by page on the
+//first touch inside of the registration memsets. This smooths out allocation latency and reduces dTLB misses on the check path,
+//at the cost of committing shadow memory in steps of SHADOW_CHUNK_SIZE bytes.
+static const int useHugeShadow = 1;
+
+//Variable for the fork-aware mode, for programs that warm up their heap and then fork (many) worker processes. If enabled,
+//the shadow memory is handled at fork() as chosen by forkShadowMode. Only FORK_SHADOW_WIPE changes the behaviour: the child
+//then forgets the pre-fault windows of the parent (pthread_atfork()), so its new shadow memory is committed in bulk again.
+//With FORK_SHADOW_COPY, the shadow memory is inherited copy-on-write, exactly as with the mode disabled.
+static const int useForkShadow = 1;
+
+//What the shadow memory looks like in a child process (only used if useForkShadow is enabled). With FORK_SHADOW_COPY, the
+//child inherits the shadow memory copy-on-write, which keeps all inherited objects checked. With FORK_SHADOW_WIPE, the shadow
+//memory is mapped MADV_WIPEONFORK: fork() does not copy its page tables and the child starts with a clean (addressable) shadow
+//memory, rebuilding it for its own allocations only. Inherited objects are no longer checked in that case, but are never
+//reported falsely either. (MADV_DONTFORK cannot be used, since every check in the child reads the shadow memory.)
+static const int forkShadowMode = FORK_SHADOW_COPY;
+
+//Variable for the memory accounting of the framework. If enabled, the committed shadow memory (measured with mincore() over
+//the written shadow chunks), the red-zone bytes, the bytes cached in the free-lists and the metadata bytes are reported at
+//exit as [setup-report] keys (see benchmark-utils), so the memory overhead can be broken down by source.
+static const int shadowAccounting = 1;
+
+//Variable for the guard-page mode for large allocations. If enabled, allocations of at least guardPageThreshold bytes get no
+//red-zones, but their own mmap() region, with the payload right-aligned against a PROT_NONE guard page (rounded up to 16 bytes
+//for alignment, the slack is poisoned with the red-zone pattern). Overflows trap in hardware, and the shadow memory of these
+//blocks is never written: a check that fails on (stale) shadow memory, or that hits the poisoned slack, consults the table of
+//guarded blocks before reporting. Only used with the standard allocator (useFreeLists disabled).
+static const int useGuardPages = 1;
+
+//Variable for an additional guard page in front of guarded blocks (only used if useGuardPages is enabled). Since the payload is
+//right-aligned, underflows only reach this page after passing the (less than a page of) slack in front of the payload.
+static const int useLeftGuardPage = 1;
+
 //For debugging purposes. Increases runtime overhead by almost 100%.
 static const int debug = 1;
 
@@ -185,9 +321,166 @@ static int initShadowMemory(){
 		return 1;
 	}
 
+	if(useForkShadow == 0 && forkShadowMode == FORK_SHADOW_WIPE){
+#ifdef MADV_WIPEONFORK
+		if(madvise(shadowMemStart, SIZE, MADV_WIPEONFORK) == -1){
+			printf("WARNING: FAILED TO MARK THE SHADOW MEMORY AS WIPE-ON-FORK.\n");
+		}
+#else
+		printf("WARNING: WIPE-ON-FORK UNSUPPORTED, SHADOW MEMORY IS COPIED ON FORK.\n");
+#endif
+	}
+
+	if(useHugeShadow == 0){
+		/* Only marks the mapping, nothing is committed here. If transparent huge pages are disabled on the system (or for
+		   this process, e.g., when running under nothp), the shadow memory is still pre-faulted, but with regular pages. */
+		if(madvise(shadowMemStart, SIZE, MADV_HUGEPAGE) == -1 && debug == 0){
+			printf("WARNING: TRANSPARENT HUGE PAGES UNAVAILABLE FOR THE SHADOW MEMORY.\n");
+		}
+
+		pagesz = sysconf(_SC_PAGESIZE);
+	}
+
 	return 0;
 }
 
+static void markShadowChunks(void *shadowAddr, size_t sz){
+	/* Mark the shadow chunks covering [shadowAddr, shadowAddr + sz) as written. */
+	if(debug == 0 && (shadowAddr == NULL || sz == 0)){
+		return;
+	}
+
+	unsigned long long int first;
+	first = ((unsigned long long int) shadowAddr - LOC) / SHADOW_CHUNK_SIZE;
+
+	unsigned long long int last;
+	last = (((unsigned long long int) shadowAddr + sz - 1) - LOC) / SHADOW_CHUNK_SIZE;
+
+	for(unsigned long long int chunk = first; chunk <= last && chunk < SHADOW_CHUNKS; chunk++){
+		BIT_SET(shadowChunkMap, chunk);
+	}
+
+	return;
+}
+
+static size_t getCommittedShadowMemory(){
+	/* Count the resident pages of all written shadow chunks. Chunks that were never written cannot be committed (the
+	   mapping is MAP_NORESERVE), so they are skipped, a byte of the bitmap (8 chunks) at a time. */
+	unsigned char residency[SHADOW_CHUNK_SIZE / 4096];
+
+	size_t committed;
+	committed = 0;
+
+	for(unsigned long long int chunk = 0; chunk < SHADOW_CHUNKS; chunk++){
+		if(shadowChunkMap[BIT_OFFSET(chunk)] == 0){
+			chunk = chunk + 7;
+			continue;
+		}
+
+		if(!BIT_TST(shadowChunkMap, chunk)){
+			continue;
+		}
+
+		if(mincore((void*) (LOC + (chunk * SHADOW_CHUNK_SIZE)), SHADOW_CHUNK_SIZE, residency) == -1){
+			continue;
+		}
+
+		for(size_t page = 0; page < SHADOW_CHUNK_SIZE / pagesz; page++){
+			if(residency[page] & 1){
+				committed = committed + pagesz;
+			}
+		}
+	}
+
+	return committed;
+}
+
+static int populateShadowMemory(void *start, size_t len){
+	if(shadowAccounting == 0){
+		markShadowChunks(start, len);
+	}
+
+#ifdef MADV_POPULATE_WRITE
+	/* Commit the entire range at once (Linux 5.14 and up). */
+	if(madvise(start, len, MADV_POPULATE_WRITE) == 0){
+		return 0;
+	}
+#endif
+
+	/* Touch every page of the range for writing, without changing its contents. */
+	for(size_t offset = 0; offset < len; offset += pagesz){
+		__atomic_fetch_or((unsigned char*) (start + offset), 0, __ATOMIC_RELAXED);
+	}
+
+	return 0;
+}
+
+static int prefaultShadowMemory(void *shadowAddr, size_t sz){
+	/* Bulk pre-fault the shadow chunks covering [shadowAddr, shadowAddr + sz), unless they already lie in a pre-faulted
+	   window. */
+	if(debug == 0 && (shadowAddr == NULL || sz == 0)){
+		return 1;
+	}
+
+	unsigned long long int start;
+	start = (unsigned long long int) shadowAddr & ~(SHADOW_CHUNK_SIZE - 1);
+
+	unsigned long long int end;
+	end = ((unsigned long long int) shadowAddr + sz + SHADOW_CHUNK_SIZE - 1) & ~(SHADOW_CHUNK_SIZE - 1);
+
+	shadowWindow *window;
+	window = NULL;
+
+	for(int i = 0; i < SHADOW_WINDOWS; i++){
+		if(shadowWindows[i].start <= start && end <= shadowWindows[i].end){
+			/* Already pre-faulted, which is the common case. */
+			return 0;
+		}
+
+		if(start <= shadowWindows[i].end && shadowWindows[i].start <= end && shadowWindows[i].end != 0){
+			/* Overlapping or adjacent window, so grow that one instead of starting a new window. */
+			window = &shadowWindows[i];
+		}
+	}
+
+	/* The heap grows, so also pre-fault a few chunks beyond what is needed right now. */
+	end = end + (shadowPrefaultAhead * SHADOW_CHUNK_SIZE);
+
+	if(window == NULL){
+		window = &shadowWindows[nextShadowWindow];
+		nextShadowWindow = (nextShadowWindow + 1) % SHADOW_WINDOWS;
+
+		window->start = start;
+		window->end = start;
+	}
+
+	if(start < window->start){
+		populateShadowMemory((void*) start, window->start - start);
+		shadowPrefaultedChunks = shadowPrefaultedChunks + ((window->start - start) / SHADOW_CHUNK_SIZE);
+
+		window->start = start;
+	}
+
+	if(end > window->end){
+		populateShadowMemory((void*) window->end, end - window->end);
+		shadowPrefaultedChunks = shadowPrefaultedChunks + ((end - window->end) / SHADOW_CHUNK_SIZE);
+
+		window->end = end;
+	}
+
+	return 0;
+}
+
+static void childFork(){
+	/* Only installed with FORK_SHADOW_WIPE: the pre-faulted windows are gone, so forget them and let the next registrations
+	   pre-fault the shadow memory in bulk again. (With FORK_SHADOW_COPY they are shared copy-on-write with the parent, and
+	   pre-faulting them again would copy whole windows.) */
+	memset(shadowWindows, 0, sizeof(shadowWindows));
+	nextShadowWindow = 0;
+
+	return;
+}
+
 static size_t calcRZSize(size_t scale){
 	/* The minimum size currently is 32 bytes, where scale N = 5, and the standard size is 128 bytes,
 	   with scale N = 7. */
@@ -211,6 +504,12 @@ static int unloadLib(){
 __attribute__((constructor))
 int initLib(){
 	/* Function to set up some necessary variables/values. Called upon the use of any (callable) function. */
+	char *sampleRate;
+	sampleRate = getenv("HMBOUNDS_SAMPLE_RATE");
+	if(sampleRate != NULL && atoi(sampleRate) > 0){
+		__hmbounds_sample_rate = atoi(sampleRate);
+	}
+
 	if(useRegistration == 0){
 		if(initShadowMemory() == 1){
 			/* Something went wrong while pre-allocating the virtual memory space required for the
@@ -220,6 +519,18 @@ int initLib(){
 		}
 	}
 
+	if(useGuardPages == 0){
+		pagesz = sysconf(_SC_PAGESIZE);
+	}
+
+	if(useForkShadow == 0 && forkShadowMode == FORK_SHADOW_WIPE){
+		/* The runtime holds no locks, so nothing has to be done before the fork() itself. */
+		if(pthread_atfork(NULL, NULL, childFork) != 0){
+			printf("ERROR: FAILED TO INSTALL FORK HANDLERS.\n");
+			return 1;
+		}
+	}
+
 	if(debug == 0){
 		if(fastCheckInit == 0){
 			printf("Fast Check: ACTIVATED\n");		
@@ -248,6 +559,205 @@ int initLib(){
 
 	return 0;
 }
+
+__attribute__((destructor))
+static void reportShadowMemory(){
+	/* Report the memory overhead of the framework, broken down by source. The report parser of the infrastructure picks
+	   these up next to the keys of the rusage report (maxrss_kb, etc). */
+	if(shadowAccounting == 1){
+		return;
+	}
+
+	report_begin();
+	reporti("shadow_committed_bytes", getCommittedShadowMemory());
+	reporti("shadow_prefaulted_chunks", shadowPrefaultedChunks);
+	reporti("redzone_bytes", redzoneBytes);
+	reporti("freelist_cached_bytes", freeListBytes);
+	reporti("metadata_bytes", metadataBytes);
+	report_end();
+}
+/*------------------------------*/
+
+/*----------------Guard Page Functions----------------*/
+static int getGuardedBlock(void *mem){
+	/* Returns the index of the guarded block whose mapping contains mem, or -1 if there is none. */
+	if(guardedBlockCount == 0 || (unsigned long long int) mem < guardedLow || (unsigned long long int) mem >= guardedHigh){
+		return -1;
+	}
+
+	/* Binary search for the last block with a mapping starting at (or before) mem. */
+	size_t low;
+	low = 0;
+
+	size_t high;
+	high = guardedBlockCount;
+
+	while(low < high){
+		size_t middle;
+		middle = (low + high) / 2;
+
+		if(guardedBlocks[middle].mapStart <= mem){
+			low = middle + 1;
+		}else{
+			high = middle;
+		}
+	}
+
+	if(low == 0){
+		return -1;
+	}
+
+	if(mem >= guardedBlocks[low - 1].mapStart + guardedBlocks[low - 1].mapLength){
+		return -1;
+	}
+
+	return (int) (low - 1);
+}
+
+static size_t getGuardedBlockSize(void *mem){
+	/* Returns the size of the guarded block starting at mem, or 0 if mem is not the start of a guarded block. */
+	int index;
+	index = getGuardedBlock(mem);
+
+	if(index == -1 || guardedBlocks[index].start != mem){
+		return 0;
+	}
+
+	return guardedBlocks[index].size;
+}
+
+static int checkGuardedBlock(void *mem, int accessSize){
+	/* Returns -1 if mem does not lie in a guarded block, 0 if the access lies within the payload of one, and 1 if the
+	   access touches the slack around the payload. */
+	int index;
+	index = getGuardedBlock(mem);
+
+	if(index == -1){
+		return -1;
+	}
+
+	if(mem >= guardedBlocks[index].start && (mem + accessSize) <= (guardedBlocks[index].start + guardedBlocks[index].size)){
+		return 0;
+	}
+
+	return 1;
+}
+
+static int insertGuardedBlock(void *mem, size_t sz, void *mapStart, size_t mapLength){
+	if(guardedBlockCount == guardedBlockCapacity){
+		size_t capacity;
+		capacity = guardedBlockCapacity * 2;
+		if(capacity == 0){
+			capacity = 64;
+		}
+
+		guardedBlock *blocks;
+		blocks = (guardedBlock*) realloc(guardedBlocks, capacity * sizeof(struct guardedBlock));
+		if(blocks == NULL){
+			return 1;
+		}
+
+		guardedBlocks = blocks;
+		guardedBlockCapacity = capacity;
+	}
+
+	/* Keep the table sorted. New mappings are usually placed below the previous ones, so search from the front. */
+	size_t index;
+	index = 0;
+
+	while(index < guardedBlockCount && guardedBlocks[index].mapStart < mapStart){
+		index++;
+	}
+
+	memmove(&guardedBlocks[index + 1], &guardedBlocks[index], (guardedBlockCount - index) * sizeof(struct guardedBlock));
+
+	guardedBlocks[index].start = mem;
+	guardedBlocks[index].size = sz;
+	guardedBlocks[index].mapStart = mapStart;
+	guardedBlocks[index].mapLength = mapLength;
+
+	guardedBlockCount++;
+
+	guardedLow = (unsigned long long int) guardedBlocks[0].mapStart;
+	guardedHigh = (unsigned long long int) (guardedBlocks[guardedBlockCount - 1].mapStart + guardedBlocks[guardedBlockCount - 1].mapLength);
+
+	return 0;
+}
+
+static void *allocateGuardedBlock(size_t sz){
+	/* The payload is rounded up to 16 bytes, to keep the alignment guarantees of malloc(). */
+	size_t payload;
+	payload = (sz + 15) & ~((size_t) 15);
+
+	size_t body;
+	body = (payload + pagesz - 1) & ~((size_t) pagesz - 1);
+
+	size_t front;
+	front = 0;
+
+	if(useLeftGuardPage == 0){
+		front = pagesz;
+	}
+
+	size_t length;
+	length = front + body + pagesz;
+
+	void *mapStart;
+	mapStart = mmap(NULL, length, (PROT_READ | PROT_WRITE), (MAP_PRIVATE | MAP_ANONYMOUS), -1, 0);
+	if(mapStart == MAP_FAILED){
+		return NULL;
+	}
+
+	void *guard;
+	guard = mapStart + front + body;
+
+	if(mprotect(guard, pagesz, PROT_NONE) == -1 || (front != 0 && mprotect(mapStart, pagesz, PROT_NONE) == -1)){
+		munmap(mapStart, length);
+		return NULL;
+	}
+
+	void *mem;
+	mem = guard - payload;
+
+	if(fastCheckInit == 0 && payload != sz){
+		/* Poison the slack between the end of the object and the guard page, which the hardware cannot catch. */
+		memset(mem + sz, redzone, payload - sz);
+	}
+
+	if(insertGuardedBlock(mem, sz, mapStart, length) == 1){
+		munmap(mapStart, length);
+		return NULL;
+	}
+
+	return mem;
+}
+
+static int freeGuardedBlock(void *mem){
+	/* Returns 0 if mem was a guarded block (which is now unmapped), and 1 otherwise. */
+	int index;
+	index = getGuardedBlock(mem);
+
+	if(index == -1 || guardedBlocks[index].start != mem){
+		return 1;
+	}
+
+	if(munmap(guardedBlocks[index].mapStart, guardedBlocks[index].mapLength) == -1){
+		printf("ERROR: FAILED TO UNMAP GUARDED BLOCK.\n");
+	}
+
+	memmove(&guardedBlocks[index], &guardedBlocks[index + 1], (guardedBlockCount - index - 1) * sizeof(struct guardedBlock));
+	guardedBlockCount--;
+
+	if(guardedBlockCount == 0){
+		guardedLow = 0;
+		guardedHigh = 0;
+	}else{
+		guardedLow = (unsigned long long int) guardedBlocks[0].mapStart;
+		guardedHigh = (unsigned long long int) (guardedBlocks[guardedBlockCount - 1].mapStart + guardedBlocks[guardedBlockCount - 1].mapLength);
+	}
+
+	return 0;
+}
 /*------------------------------*/
 
 /*----------------General Functions----------------*/
@@ -348,6 +858,107 @@ static int checkRegistration(void *mem, int accessSize){
 	return -1;
 }
 
+static int checkShadowWord(unsigned char *shadowAddr, size_t count){
+	/* Returns 1 if any of the count shadow bytes is non-zero. The shadow bytes are loaded as 64-, 32- and 16-bit words, so
+	   the 2, 4 or 8 bytes of a (aligned) 16-, 32- or 64-byte access are tested with a single compare. */
+	unsigned long long int word64;
+	unsigned int word32;
+	unsigned short word16;
+
+	while(count >= 8){
+		memcpy(&word64, shadowAddr, 8);
+		if(word64 != 0){
+			return 1;
+		}
+
+		shadowAddr = shadowAddr + 8;
+		count = count - 8;
+	}
+
+	if(count >= 4){
+		memcpy(&word32, shadowAddr, 4);
+		if(word32 != 0){
+			return 1;
+		}
+
+		shadowAddr = shadowAddr + 4;
+		count = count - 4;
+	}
+
+	if(count >= 2){
+		memcpy(&word16, shadowAddr, 2);
+		if(word16 != 0){
+			return 1;
+		}
+
+		shadowAddr = shadowAddr + 2;
+		count = count - 2;
+	}
+
+	if(count == 1 && *shadowAddr != 0){
+		return 1;
+	}
+
+	return 0;
+}
+
+static int checkRegistrationVector(void *mem, int accessSize){
+	/* Check every granule covered by an access larger than 8 bytes (e.g., a 16-, 32- or 64-byte vector access), instead of
+	   only the first and last byte of it, which would accept an access spanning an entire red-zone. */
+	unsigned char *shadowAddr;
+	shadowAddr = getShadowMemoryAddress(mem);
+
+	if(debug == 0 && shadowAddr == NULL){
+		return -1;
+	}
+
+	if(ASANCheckInit == 0){
+		/* The access ends end bytes after the start of its first granule. All granules accessed up to their last byte must
+		   be fully addressable (0), the granule containing the end of the access (if any) must have at least rem addressable
+		   bytes. */
+		size_t end;
+		end = ((unsigned long long int) mem & 7) + (size_t) accessSize;
+
+		size_t whole;
+		whole = end / 8;
+
+		size_t rem;
+		rem = end % 8;
+
+		if(checkShadowWord(shadowAddr, whole) == 1){
+			return 1;
+		}
+
+		if(rem != 0){
+			unsigned char var;
+			var = shadowAddr[whole];
+
+			if(var != 0 && (var >= 8 || rem > var)){
+				return 1;
+			}
+		}
+
+		return 0;
+	}else{
+		/* The bit-flip method has no single value per granule to compare, so check the access 8 bytes at a time. */
+		for(int offset = 0; offset < accessSize; offset += 8){
+			int size;
+			size = accessSize - offset;
+			if(size > 8){
+				size = 8;
+			}
+
+			if(checkRegistration(mem + offset, size) == 1){
+				return 1;
+			}
+		}
+
+		return 0;
+	}
+
+	return -1;
+}
+
 __attribute__((always_inline, used))
 int checkMemoryAccess(void *mem, int accessSize){
 	/* Returns a negative integer if the address was invalid, 0 if there was no match, and a positive integer
@@ -360,6 +971,19 @@ int checkMemoryAccess(void *mem, int accessSize){
 	check = 0;
 
 	if(useRegistration == 0){
+		if(accessSize > 8){
+			/* Vector accesses can span an entire red-zone between their first and last byte, which the fast check cannot see,
+			   so the shadow memory of all of their granules is checked instead. */
+			check = checkRegistrationVector(mem, accessSize);
+			if(useGuardPages == 0 && getGuardedBlock(mem) != -1){
+				/* The shadow memory of guarded blocks is never registered (and is clean over their slack), so the table
+				   decides instead. */
+				check = checkGuardedBlock(mem, accessSize);
+			}
+
+			return check;
+		}
+
 		if(fastCheckInit == 0 && useFreeLists == 1){
 			/* Perform a fast check. If the pattern matches, do a slow check to see if a pattern match was not simply
 	   		   random chance. */
@@ -371,6 +995,11 @@ int checkMemoryAccess(void *mem, int accessSize){
 					return 0;
 				}else{
 					check = checkRegistration(mem, accessSize);
+					if(useGuardPages == 0 && getGuardedBlock(mem) != -1){
+						/* The shadow memory of guarded blocks is never registered, so the table decides instead. */
+						check = checkGuardedBlock(mem, accessSize);
+					}
+
 					if(check == 1){
 						/* A red-zone was indeed accessed. */
 						return 1;
@@ -388,6 +1017,11 @@ int checkMemoryAccess(void *mem, int accessSize){
 					return 0;
 				}else{
 					check = checkRegistration(mem, accessSize);
+					if(useGuardPages == 0 && getGuardedBlock(mem) != -1){
+						/* The shadow memory of guarded blocks is never registered, so the table decides instead. */
+						check = checkGuardedBlock(mem, accessSize);
+					}
+
 					if(check == 1){
 						/* A red-zone was indeed accessed. */
 						return 1;
@@ -403,6 +1037,12 @@ int checkMemoryAccess(void *mem, int accessSize){
 			}
 		}else{
 			check = checkRegistration(mem, accessSize);
+			if(useGuardPages == 0 && getGuardedBlock(mem) != -1){
+				/* The shadow memory of guarded blocks is never registered (and without fastCheckInit, their slack is not
+				   poisoned either), so the table decides instead. */
+				check = checkGuardedBlock(mem, accessSize);
+			}
+
 			if(check == 1){
 				/* A red-zone was indeed accessed. */
 				return 1;
@@ -443,6 +1083,41 @@ int checkMemoryAccess(void *mem, int accessSize){
 	return -1;
 }
 
+__attribute__((used))
+int checkMemoryRange(void *mem, size_t size){
+	/* Returns a negative integer if the address was invalid, 0 if no byte of the range lies in a red-zone, and a positive
+	   integer otherwise. Used for all accesses of a loop at once, checked before the loop. */
+	if(debug == 0 && mem == NULL){
+		return -1;
+	}
+
+	if(useRegistration == 1){
+		/* In this mode, the pattern is the only detection mechanism, so any byte of it in the range is reported. */
+		if(size != 0 && memchr(mem, redzone, size) != NULL){
+			return 1;
+		}
+
+		return 0;
+	}
+
+	/* The range is checked as one (vector) access, covering the shadow memory of all of its granules. */
+	for(size_t offset = 0; offset < size; offset += RANGE_PART){
+		size_t part;
+		part = size - offset;
+		if(part > RANGE_PART){
+			part = RANGE_PART;
+		}
+
+		int check;
+		check = checkMemoryAccess(mem + offset, (int) part);
+		if(check != 0){
+			return check;
+		}
+	}
+
+	return 0;
+}
+
 static int removeAddr(void *memL, void *memR){
 	/* Re-set the values of the shadow memory corresponding to the freed memory. */
 	void *shadowAddr;
@@ -549,6 +1224,15 @@ static int registerAddr(void *memL, void *memR){
 	size_t toWriteAM;
 	toWriteAM = (sz - sz_rem) / 8;
 
+	if(useHugeShadow == 0){
+		/* Commit the shadow memory of the entire allocation in bulk, before it is written below. */
+		prefaultShadowMemory(shadowAddrL, (shadowAddrR - shadowAddrL) + toWriteRZ);
+	}
+
+	if(shadowAccounting == 0){
+		markShadowChunks(shadowAddrL, (shadowAddrR - shadowAddrL) + toWriteRZ);
+	}
+
 	/* Write the shadow memory of the left red-zone. */
 	check = memset((unsigned char*) shadowAddrL, (unsigned char) 0xFF, toWriteRZ);
 	if(debug == 0 && check == NULL){
@@ -655,6 +1339,10 @@ static memSeg *createBlock(void *start, size_t originalsz){
 	new->startAddrL = start - rz_sz;
 	new->startAddrR = start + originalsz;
 
+	if(shadowAccounting == 0){
+		metadataBytes = metadataBytes + sizeof(struct memSeg);
+	}
+
 	return new;
 }
 
@@ -693,6 +1381,10 @@ static int returnBlockToFreeList(void *mem, int startAdd){
 
 	memoryArray[index].counter++;
 
+	if(shadowAccounting == 0){
+		freeListBytes = freeListBytes + allocation_sz;
+	}
+
 	if(startAdd == 0){
 		check = removeAddr(new->startAddrL, new->startAddrR);
 		if(debug == 0 && check == 1){
@@ -753,6 +1445,11 @@ static void *getBlockFromFreeList(size_t sz){
 		return NULL;
 	}
 
+	if(shadowAccounting == 0){
+		freeListBytes = freeListBytes - toReturn->allocsz;
+		metadataBytes = metadataBytes - sizeof(struct memSeg);
+	}
+
 	/* Free the data structure used to keep track of the entry in the free-list, since it will now be in-use. */
 	free(toReturn);
 
@@ -861,6 +1558,16 @@ static int allocateFreeList(size_t sz){
 		return 1;
 	}
 
+	if(useHugeShadow == 0){
+		/* The arena grows, so pre-fault the shadow memory of the entire new block at once. */
+		prefaultShadowMemory(getShadowMemoryAddress(blockStart), (newsz / 8) + 1);
+	}
+
+	if(shadowAccounting == 0){
+		/* The red-zones of the free-list blocks are shared between neighbours, and stay in place for the lifetime of the block. */
+		redzoneBytes = redzoneBytes + (rz_sz * (standardPreAllocSize + 1));
+	}
+
 	/* Ready the free-list for actual use. */
 	check = setFreeList(blockStart, index, sz);
 	if(debug == 0 && (check == 1 || check == -1)){
@@ -886,9 +1593,18 @@ void Dlib_free(void *mem){
 			return;
 		}
 	}else{
+		if(useGuardPages == 0 && freeGuardedBlock(mem) == 0){
+			/* A guarded block, which has no red-zones and no registration. */
+			return;
+		}
+
 		/* Return the pointer to the actual start of the contiguous memory region. */
 		mem = mem - rz_sz;
 
+		if(shadowAccounting == 0){
+			redzoneBytes = redzoneBytes - (2 * rz_sz);
+		}
+
 		/* Remove the red-zones and object memory region from the shadow memory. The right red-zone in this case is
 	  	   not useful, but only exists for compatibility purposes. */
 		if(useRegistration == 0){
@@ -951,6 +1667,10 @@ void *Dlib_malloc(size_t sz){
 
 		return toReturn;
 	}else{
+		if(useGuardPages == 0 && sz >= guardPageThreshold){
+			return allocateGuardedBlock(sz);
+		}
+
 		size_t ac_sz;
 		ac_sz = sz + (2 * rz_sz);
 
@@ -985,6 +1705,10 @@ void *Dlib_malloc(size_t sz){
 			}
 		}
 
+		if(shadowAccounting == 0){
+			redzoneBytes = redzoneBytes + (2 * rz_sz);
+		}
+
 		/* Re-align pointer to the address where the actual application memory starts. */
 		mem = mem + rz_sz;
 
@@ -1038,8 +1762,14 @@ void *Dlib_realloc(void *mem, size_t nsz){
 			getsz--;
 			oldsz = *getsz;
 		}else{
-			oldsz = malloc_usable_size(mem);
-			oldsz = oldsz - (2 * rz_sz);
+			if(useGuardPages == 0){
+				oldsz = getGuardedBlockSize(mem + rz_sz);
+			}
+
+			if(oldsz == 0){
+				oldsz = malloc_usable_size(mem);
+				oldsz = oldsz - (2 * rz_sz);
+			}
 		}
 
 		if(debug == 0 && oldsz == 0){
@@ -1136,6 +1866,10 @@ void *Dlib_memalign(size_t alignment, size_t sz){
 		}
 	}
 
+	if(shadowAccounting == 0){
+		redzoneBytes = redzoneBytes + (2 * rz_sz);
+	}
+
 	/* Re-align pointer to the address where the actual application memory starts. */
 	mem = mem + rz_sz;
 
@@ -0,0 +1,93 @@
+#include <noinstrument.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+//Amount of check sites of which the executions can be counted. Must be a power of two.
+#define PROFILE_SITES 65536
+
+//Amount of slots of the table probed for a site, before its executions are no longer counted.
+#define PROFILE_PROBES 64
+
+#define countCheckSite NOINSTRUMENT(countCheckSite)
+#define writeProfile NOINSTRUMENT(writeProfile)
+
+typedef struct siteCounter{
+	unsigned long int site;
+	unsigned long int count;
+}siteCounter;
+
+//The execution counts of the check sites of a program instrumented with -hm-profile-gen, in an open addressing table on
+//the (non-zero) site IDs.
+static siteCounter siteCounters[PROFILE_SITES];
+
+//Amount of executions of sites which did not fit in the table.
+static unsigned long int droppedCounts = 0;
+
+/*----------------Profile Functions----------------*/
+void countCheckSite(unsigned long int site){
+	unsigned long int slot;
+	slot = (site * 0x9E3779B97F4A7C15UL) >> 32;
+
+	for(int i = 0; i < PROFILE_PROBES; i++){
+		siteCounter *counter;
+		counter = &siteCounters[(slot + i) & (PROFILE_SITES - 1)];
+
+		unsigned long int found;
+		found = __atomic_load_n(&counter->site, __ATOMIC_RELAXED);
+
+		if(found == 0){
+			/* Claim the empty slot. If another thread claimed it first (possibly for the same site), found is set to
+			   the site it holds. */
+			if(__atomic_compare_exchange_n(&counter->site, &found, site, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED)){
+				found = site;
+			}
+		}
+
+		if(found == site){
+			__atomic_fetch_add(&counter->count, 1, __ATOMIC_RELAXED);
+			return;
+		}
+	}
+
+	__atomic_fetch_add(&droppedCounts, 1, __ATOMIC_RELAXED);
+}
+
+__attribute__((destructor))
+void writeProfile(){
+	/* The profile is appended on exit to HMBOUNDS_PROFILE (or hmbounds.profile), as lines of "<site> <executions>", so the
+	   runs of a training set accumulate in one file (the pass sums the lines of a site). Remove the file to start over.
+	   Programs which did not count any site do not write anything. */
+	FILE *profile;
+	profile = NULL;
+
+	for(int i = 0; i < PROFILE_SITES; i++){
+		if(siteCounters[i].site == 0){
+			continue;
+		}
+
+		if(profile == NULL){
+			const char *path;
+			path = getenv("HMBOUNDS_PROFILE");
+			if(path == NULL){
+				path = "hmbounds.profile";
+			}
+
+			profile = fopen(path, "a");
+			if(profile == NULL){
+				printf("ERROR: FAILED TO WRITE THE CHECK SITE PROFILE.\n");
+				return;
+			}
+		}
+
+		fprintf(profile, "%lx %lu\n", siteCounters[i].site, siteCounters[i].count);
+	}
+
+	if(profile != NULL){
+		fclose(profile);
+	}
+
+	if(droppedCounts != 0){
+		printf("ERROR: CHECK SITE PROFILE FULL, %lu EXECUTIONS WERE NOT COUNTED.\n", droppedCounts);
+	}
+}
+/*--------------------------------*/